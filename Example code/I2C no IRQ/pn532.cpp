@@ -36,7 +36,83 @@ pn532::pn532( hwlib::pin_oc & scl, hwlib::pin_oc & sda, hwlib::target::pin_out r
 	sel( hwlib::pin_out_dummy ),
 	irq( irq ),
 	using_i2c( true ),
-	irq_present( irq_present )
+	irq_present( irq_present ),
+	target_active(),
+	target_selected( false ),
+	raw_settings_known( false ),
+	raw_crc( true ),
+	raw_parity( true ),
+	shadow(),
+	shadow_size( 0 ),
+	parameters_active(),
+	parameters_known( false ),
+	exchanges( 0 ),
+	command_sent( 0x00 ),
+	passive_retries( 0xFF ),
+	gpio_p3( 0x00 ),
+	gpio_p7( 0x00 ),
+	gpio_pending_p3( 0x00 ),
+	gpio_pending_p7( 0x00 ),
+	gpio_input_p3( 0x00 ),
+	gpio_input_p7( 0x00 ),
+	gpio_known( false ),
+	mux( nullptr ),
+	mux_channel( MUX_NO_CHANNEL ),
+	presence_interval_us( 100000 ),
+	presence_checked_us( 0 )
+	{
+		pn532_reset();
+		samconfig();
+		// Initialise all usable GPIO ports to default LOW.
+		write_gpio( 0x94, 0x80 );
+	}
+
+/// \brief
+/// Constructor for this class using I2C behind a multiplexer.
+/// \details
+/// The PN532 sits on channel (0 to MUX_CHANNELS - 1.) of mux and all its
+/// transfers go over the bus of mux, which all readers behind it share.
+/// The multiplexer is switched to channel before every transfer when
+/// another channel is selected, see i2c_mux. Besides the reset pin an IRQ
+/// pin can be passed to reduce the traffic on the shared bus. addr is the
+/// I2C address of the PN532 itself, 0x24 unless the board was changed.
+/// The constructor automatically resets the chip and configures it for
+/// normal operation mode.
+
+pn532::pn532( i2c_mux & mux, const uint8_t channel, hwlib::target::pin_out rst, hwlib::target::pin_in irq, const bool irq_present, const uint8_t addr ):
+	scl( hwlib::pin_oc_dummy ),
+	sda( hwlib::pin_oc_dummy ),
+	i2c_bus ( hwlib::i2c_bus_bit_banged_scl_sda( scl, sda ) ),
+	rst( rst ),
+	addr( addr  ),
+	spi_bus( hwlib::spi_bus_bit_banged_sclk_mosi_miso( hwlib::pin_out_dummy, hwlib::pin_out_dummy, hwlib::pin_in_dummy) ),
+	sel( hwlib::pin_out_dummy ),
+	irq( irq ),
+	using_i2c( true ),
+	irq_present( irq_present ),
+	target_active(),
+	target_selected( false ),
+	raw_settings_known( false ),
+	raw_crc( true ),
+	raw_parity( true ),
+	shadow(),
+	shadow_size( 0 ),
+	parameters_active(),
+	parameters_known( false ),
+	exchanges( 0 ),
+	command_sent( 0x00 ),
+	passive_retries( 0xFF ),
+	gpio_p3( 0x00 ),
+	gpio_p7( 0x00 ),
+	gpio_pending_p3( 0x00 ),
+	gpio_pending_p7( 0x00 ),
+	gpio_input_p3( 0x00 ),
+	gpio_input_p7( 0x00 ),
+	gpio_known( false ),
+	mux( &mux ),
+	mux_channel( channel ),
+	presence_interval_us( 100000 ),
+	presence_checked_us( 0 )
 	{
 		pn532_reset();
 		samconfig();
@@ -62,7 +138,30 @@ pn532::pn532( hwlib::spi_bus_bit_banged_sclk_mosi_miso & spi_bus, hwlib::pin_out
 	sel( sel ),
 	irq( irq ),
 	using_i2c( false ),
-	irq_present( irq_present )
+	irq_present( irq_present ),
+	target_active(),
+	target_selected( false ),
+	raw_settings_known( false ),
+	raw_crc( true ),
+	raw_parity( true ),
+	shadow(),
+	shadow_size( 0 ),
+	parameters_active(),
+	parameters_known( false ),
+	exchanges( 0 ),
+	command_sent( 0x00 ),
+	passive_retries( 0xFF ),
+	gpio_p3( 0x00 ),
+	gpio_p7( 0x00 ),
+	gpio_pending_p3( 0x00 ),
+	gpio_pending_p7( 0x00 ),
+	gpio_input_p3( 0x00 ),
+	gpio_input_p7( 0x00 ),
+	gpio_known( false ),
+	mux( nullptr ),
+	mux_channel( MUX_NO_CHANNEL ),
+	presence_interval_us( 100000 ),
+	presence_checked_us( 0 )
 	{
 		pn532_reset();
 		samconfig();
@@ -127,30 +226,42 @@ void pn532::samconfig() {
 
 void pn532::read_status_byte() {
 
+	while( !response_ready() ) {}
+
+}
+
+/// \brief
+/// Function to check once whether the PN532 has a frame ready.
+/// \details
+/// Reads the status byte (or the IRQ pin when present.) a single time and
+/// returns whether it is READY, without waiting. Use this after
+/// start_list_target() to do other work while the PN532 is busy.
+
+bool pn532::response_ready() {
+
 	uint8_t ready = 0x00;
-	while( ready != 0x01 ) {
+	if( irq_present ) {
 		
-		if( irq_present ) {
+		ready = !irq.read();
+		
+	}
+	else {
+	
+		if( using_i2c ) {
 			
-			ready = !irq.read();
+			select_channel();
+			active_bus().read( addr ).read( ready );
 			
 		}
 		else {
-		
-			if( using_i2c ) {
-				
-				i2c_bus.i2c_bus::read( addr ).read( ready );
-				
-			}
-			else {
-				
-				hwlib::spi_bus::spi_transaction spi_transaction = spi_bus.transaction( sel );
-				spi_transaction.write( SPI_SR );
-				ready = spi_transaction.read_byte();
-				
-			}
+			
+			hwlib::spi_bus::spi_transaction spi_transaction = spi_bus.transaction( sel );
+			spi_transaction.write( SPI_SR );
+			ready = spi_transaction.read_byte();
+			
 		}
 	}
+	return ready == 0x01;
 }
 
 /// \brief
@@ -168,7 +279,8 @@ bool pn532::read_ack_nack() {
 	
 	if( using_i2c ) {
 		
-		i2c_bus.i2c_bus::read( addr ).read( bytes_in, 7 );
+		select_channel();
+		active_bus().read( addr ).read( bytes_in, 7 );
 		
 	}
 	else {
@@ -204,14 +316,20 @@ bool pn532::read_ack_nack() {
 
 void pn532::write( const uint8_t bytes_out[], const size_t & size_out, uint8_t timeout ) {
 	
+	exchanges += 1;
+	
+	// Command code after the TFI, read_response() checks the answer is for it.
+	command_sent = ( bytes_out[3] == 0xFF && bytes_out[4] == 0xFF ) ? bytes_out[9] : bytes_out[6];
+
 	if( using_i2c ) {
 		
 		// Write and read bytes on the i2c bus.
-		i2c_bus.i2c_bus::write( addr ).write( bytes_out, size_out );
+		select_channel();
+		active_bus().write( addr ).write( bytes_out, size_out );
 		read_status_byte();
 		while( !read_ack_nack() ) {
 			
-			i2c_bus.i2c_bus::write( addr ).write( bytes_out, size_out );
+			active_bus().write( addr ).write( bytes_out, size_out );
 			read_status_byte();
 			timeout -= 1;
 			if( timeout <= 0 ) {
@@ -245,7 +363,8 @@ void pn532::read( uint8_t bytes_in[], const size_t & size_in ) {
 	read_status_byte();
 	if( using_i2c) {
 		
-		i2c_bus.i2c_bus::read( addr ).read( bytes_in, size_in );
+		select_channel();
+		active_bus().read( addr ).read( bytes_in, size_in );
 		
 	}
 	else {
@@ -257,6 +376,251 @@ void pn532::read( uint8_t bytes_in[], const size_t & size_in ) {
 	}
 }
 
+/// \brief
+/// Function to wrap a command in an information frame.
+/// \details
+/// This function adds the preamble, start code, length, length checksum,
+/// TFI, data checksum and postamble around command[] and places the result
+/// in bytes_out[], which must hold size_command + 11 bytes. The first byte
+/// of command[] must be the command code. Commands longer than
+/// FRAME_NORMAL_MAX bytes become an extended frame (LEN and LCS 0xFF,
+/// followed by a 2 byte length and its checksum.), at most FRAME_DATA_MAX - 1
+/// bytes fit. The size of the frame is returned.
+///
+/// This function is public and static so frames that never change can be
+/// built once, see ndef_type4_tag.
+
+size_t pn532::build_frame( const uint8_t command[], const size_t & size_command, uint8_t bytes_out[] ) {
+
+	bytes_out[0] = PREAMBLE;
+	bytes_out[1] = START_CODE_1;
+	bytes_out[2] = START_CODE_2;
+	size_t size_out = 3;
+	
+	const size_t LEN = size_command + 1;
+	if( LEN > FRAME_NORMAL_MAX + 1 ) {
+		
+		uint8_t LENM = LEN >> 8;
+		uint8_t LENL = LEN;
+		bytes_out[ size_out++ ] = 0xFF;
+		bytes_out[ size_out++ ] = 0xFF;
+		bytes_out[ size_out++ ] = LENM;
+		bytes_out[ size_out++ ] = LENL;
+		bytes_out[ size_out++ ] = ~( LENM + LENL ) + 1;
+		
+	}
+	else {
+		
+		bytes_out[ size_out++ ] = LEN;
+		bytes_out[ size_out++ ] = ~LEN + 1;
+		
+	}
+	
+	uint8_t DCS = TFI;
+	bytes_out[ size_out++ ] = TFI;
+	for( size_t i = 0; i < size_command; i++ ) {
+		
+		bytes_out[ size_out++ ] = command[i];
+		DCS += command[i];
+		
+	}
+	bytes_out[ size_out++ ] = ~DCS + 1;
+	bytes_out[ size_out++ ] = POSTAMBLE;
+	
+	return size_out;
+}
+
+/// \brief
+/// Function to wrap a command in an information frame and send it.
+/// \details
+/// See build_frame() for the format, at most FRAME_DATA_MAX - 1 bytes can
+/// be sent this way.
+
+void pn532::write_command( const uint8_t command[], const size_t & size_command ) {
+
+	uint8_t bytes_out[ FRAME_DATA_MAX + 11 ];
+	write( bytes_out, build_frame( command, size_command, bytes_out ) );
+
+}
+
+/// \brief
+/// Function to read an information frame and unwrap its data.
+/// \details
+/// This function reads the response frame that follows a command sent with
+/// write() or write_command() and copies at most size_response data bytes,
+/// which are the bytes after the response code, into response[]. Both normal
+/// and extended frames are understood. size_response is set to the amount
+/// of data bytes in the frame, which can be more than were copied.
+/// Returns false, with size_response 0, for an error frame, a frame that
+/// fails its length or data checksum, or one that does not answer the
+/// command that was sent last.
+
+bool pn532::read_response( uint8_t response[], size_t & size_response ) {
+
+	// Status byte, preamble, start code, (extended) length, TFI, response code, data, DCS and postamble.
+	const size_t size_room = size_response + 13;
+	uint8_t bytes_in[ FRAME_DATA_MAX + 12 ];
+	const size_t size_in = size_room < sizeof( bytes_in ) ? size_room : sizeof( bytes_in );
+	size_response = 0;
+	
+	read( bytes_in, size_in );
+	
+	size_t LEN = bytes_in[4];
+	size_t start = 6;
+	if( bytes_in[4] == 0xFF && bytes_in[5] == 0xFF ) {
+		
+		if( uint8_t( bytes_in[6] + bytes_in[7] + bytes_in[8] ) != 0x00 ) {
+			return false;
+		}
+		LEN = ( bytes_in[6] << 8 ) | bytes_in[7];
+		start = 9;
+		
+	}
+	else if( uint8_t( bytes_in[4] + bytes_in[5] ) != 0x00 ) {
+		return false;
+	}
+	
+	if( LEN < 2 || LEN > FRAME_DATA_MAX + 1 || bytes_in[ start ] != TFI_PN532 || bytes_in[ start + 1 ] != uint8_t( command_sent + 1 ) ) {
+		return false;
+	}
+	
+	// The DCS can only be checked when the whole frame was read.
+	if( start + LEN < size_in ) {
+		
+		uint8_t DCS = 0;
+		for( size_t i = 0; i <= LEN; i++ ) {
+			
+			DCS += bytes_in[ start + i ];
+			
+		}
+		if( DCS != 0x00 ) {
+			return false;
+		}
+		
+	}
+	
+	const size_t size_data = LEN - 2;
+	for( size_t i = 0; i < size_data && i < size_room - 13 && start + 2 + i < sizeof( bytes_in ); i++ ) {
+		
+		response[i] = bytes_in[ start + 2 + i ];
+		
+	}
+	size_response = size_data;
+	return true;
+}
+
+// Bytes to read of an answer carrying data for a buffer of size_buffer bytes
+// that already holds received bytes: the status byte and what still fits.
+// Anything longer is counted by read_response() but not read.
+static size_t exchange_room( const size_t & size_buffer, const size_t & received ) {
+	const size_t size_left = received < size_buffer ? size_buffer - received : 0;
+	return ( size_left < EXCHANGE_DATA_MAX ? size_left : EXCHANGE_DATA_MAX ) + 1;
+}
+
+/// \brief
+/// Function to send a single InDataExchange frame.
+/// \details
+/// This function sends command[] to the card, with the MI bit set in the
+/// target byte when more is true, and reads at most size_room bytes of the
+/// answer into bytes_in[], so a short answer costs a short bus transfer.
+/// bytes_in[0] is the status byte. Returns the amount of bytes in the
+/// answer, which can be more than were read, 0 when no valid frame arrived.
+
+size_t pn532::exchange_part( const bool more, const uint8_t command[], const size_t & size_command, uint8_t bytes_in[], const size_t & size_room ) {
+
+	const uint8_t tg = target_active.tg ? target_active.tg : target_card;
+	uint8_t bytes_out[ EXCHANGE_DATA_MAX + 2 ] = {CC_data_exchange, (uint8_t)( more ? tg | MI_bit : tg )};
+	for( size_t i = 0; i < size_command; i++ ) {
+		
+		bytes_out[ i + 2 ] = command[i];
+		
+	}
+	write_command( bytes_out, size_command + 2 );
+	
+	size_t size_in = size_room;
+	return read_response( bytes_in, size_in ) ? size_in : 0;
+}
+
+/// \brief
+/// Function to exchange data with the active card.
+/// \details
+/// This function sends command[] to the card through InDataExchange and
+/// copies the answer of the card into response[]. size_response holds the
+/// size of response[] when calling and the amount of bytes received after.
+/// The status byte of the PN532 is returned, 0x00 means success.
+///
+/// Commands longer than EXCHANGE_DATA_MAX bytes are split over several
+/// frames with the MI (more information.) bit set in all but the last,
+/// when the PN532 sets the MI bit in its answer the remaining parts are
+/// fetched the same way, so the whole answer ends up in response[] without
+/// the caller having to split anything. When the answer does not fit,
+/// the remaining parts are still read but dropped and status_overflow is
+/// returned.
+
+uint8_t pn532::data_exchange( const uint8_t command[], const size_t & size_command, uint8_t response[], size_t & size_response ) {
+
+	uint8_t bytes_in[ EXCHANGE_DATA_MAX + 1 ];
+	size_t size_in = 0;
+	
+	size_t sent = 0;
+	do {
+		
+		size_t size_part = size_command - sent < EXCHANGE_DATA_MAX ? size_command - sent : EXCHANGE_DATA_MAX;
+		size_in = exchange_part( sent + size_part < size_command, command + sent, size_part, bytes_in, exchange_room( size_response, 0 ) );
+		sent += size_part;
+		if( size_in == 0 ) {
+			size_response = 0;
+			return status_no_frame;
+		}
+		// Only the lower 6 bits are the error code, the others are the MI and NAD flags.
+		if( ( bytes_in[0] & 0x3F ) != 0x00 ) {
+			if( ( bytes_in[0] & 0x3F ) == status_timeout ) {
+				target_selected = false;
+			}
+			size_response = 0;
+			return bytes_in[0] & 0x3F;
+		}
+		
+	} while( sent < size_command );
+	
+	size_t received = 0;
+	bool overflow = false;
+	while( true ) {
+		
+		for( size_t i = 1; i < size_in && i <= EXCHANGE_DATA_MAX; i++ ) {
+			
+			if( received < size_response ) {
+				response[ received++ ] = bytes_in[i];
+			}
+			else {
+				overflow = true;
+			}
+			
+		}
+		if( !( bytes_in[0] & MI_bit ) ) {
+			break;
+		}
+		
+		// The card has more to say, an InDataExchange without data fetches the next part.
+		size_in = exchange_part( false, command, 0, bytes_in, exchange_room( size_response, received ) );
+		if( size_in == 0 ) {
+			size_response = received;
+			return status_no_frame;
+		}
+		if( ( bytes_in[0] & 0x3F ) != 0x00 ) {
+			if( ( bytes_in[0] & 0x3F ) == status_timeout ) {
+				target_selected = false;
+			}
+			size_response = received;
+			return bytes_in[0] & 0x3F;
+		}
+		
+	}
+	
+	size_response = received;
+	return overflow ? status_overflow : 0x00;
+}
+
 /// \brief
 /// Function to get the boards firmware version.
 /// \details
@@ -276,27 +640,42 @@ void pn532::read( uint8_t bytes_in[], const size_t & size_in ) {
 
 void pn532::get_firmware_version( std::array<uint8_t, 4> & firmware ) {
 
-	uint8_t CC_firmware = CC_get_firm;
-	uint8_t LEN = 2;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~(TFI + CC_firmware) + 1;
-	
-	const size_t size_out = 9;
-	const size_t size_in = 13;
-	const uint8_t bytes_out[ size_out ] = {PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI, CC_firmware, DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
+	const pn532_result<pn532_firmware> result = read_firmware();
 	
-	write( bytes_out, size_out );
-	read( bytes_in, size_in );
+	firmware[0] = result.value.ic;
+	firmware[1] = result.value.version;
+	firmware[2] = result.value.revision;
+	firmware[3] = result.value.support;
 	
-	hwlib::cout << hwlib::hex << "PN532 firmware version: " << bytes_in[9] << " firmware revision: " << bytes_in[10] << "\n";
-	hwlib::cout << hwlib::hex << "PN532 IC version: " << bytes_in[8] << " Supporting: " << bytes_in[11] << "\n\n";
-	
-	for( size_t i = 8; i < 12; i++ ) {
-		
-		//firmware[ i - 8 ] = bytes_in[i];
+	PN532_DEBUG( hwlib::hex << "PN532 firmware version: " << firmware[1] << " firmware revision: " << firmware[2] << "\n" );
+	PN532_DEBUG( hwlib::hex << "PN532 IC version: " << firmware[0] << " Supporting: " << firmware[3] << "\n\n" );
+
+}
+
+/// \brief
+/// Function to read the boards firmware version into a struct.
+/// \details
+/// Same command as get_firmware_version(), but nothing gets printed and
+/// status tells whether the PN532 answered.
+
+pn532_result<pn532_firmware> pn532::read_firmware() {
 
+	const uint8_t command[1] = {CC_get_firm};
+	uint8_t response[4];
+	pn532_result<pn532_firmware> result;
+	
+	size_t size_response = 4;
+	write_command( command, 1 );
+	if( !read_response( response, size_response ) || size_response != 4 ) {
+		return result;
 	}
+	
+	result.value.ic = response[0];
+	result.value.version = response[1];
+	result.value.revision = response[2];
+	result.value.support = response[3];
+	result.status = 0x00;
+	return result;
 }
 
 /// \brief
@@ -311,6 +690,8 @@ void pn532::get_firmware_version( std::array<uint8_t, 4> & firmware ) {
 /// shared with the spi bus, therefor the second byte will not contain any usable data
 /// when using SPI. GPIO port 3 numbers 32 and 34 are reserved and will therefor always
 /// read as HIGH. The I0I1 byte will always read as 00000001 for I2c and 00000010 for SPI.
+/// The states are answered from what the library last wrote without any bus traffic,
+/// unless pins are used as inputs, see watch_gpio_inputs().
 ///
 /// gpio port 3 format:
 /// 0, 0, P35, P34, P33, P32, P31, P30
@@ -323,34 +704,59 @@ void pn532::get_firmware_version( std::array<uint8_t, 4> & firmware ) {
 
 void pn532::read_gpio( std::array<uint8_t, 3> & gpio_states ) {
 
-	uint8_t CC_gpio_read = CC_read_gpio;
-	uint8_t LEN = 2;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~( TFI + CC_gpio_read ) + 1;
-	
-	const size_t size_out = 9;
-	const size_t size_in = 12;
-	const uint8_t bytes_out[ size_out ] = {PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI, CC_gpio_read, DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
+	const pn532_result<pn532_gpio> result = read_gpio_state();
 	
-	write( bytes_out, size_out );
-	read( bytes_in, size_in );
+	gpio_states[0] = result.value.p3;
+	gpio_states[1] = result.value.p7;
+	gpio_states[2] = result.value.interface;
 	
-	hwlib::cout << "GPIO states:\n";
-	hwlib::cout << "P3: " << bytes_in[8] << "\nP7: " << bytes_in[9] << "\n";
+	PN532_DEBUG( "GPIO states:\n" );
+	PN532_DEBUG( "P3: " << gpio_states[0] << "\nP7: " << gpio_states[1] << "\n" );
 	
-	if( bytes_in[10] == 1 ) {
-		hwlib::cout << "SEl0 ON / SEL1 OFF\n\n"; 
+	if( gpio_states[2] == 1 ) {
+		PN532_DEBUG( "SEl0 ON / SEL1 OFF\n\n" );
 	}
 	else {
-		hwlib::cout << "SEl0 OFF / SEL1 ON\n\n";
+		PN532_DEBUG( "SEl0 OFF / SEL1 ON\n\n" );
 	}
+}
+
+/// \brief
+/// Function to read the boards GPIO pins into a struct.
+/// \details
+/// Same as read_gpio(), but nothing gets printed and status tells whether
+/// the PN532 answered.
+
+pn532_result<pn532_gpio> pn532::read_gpio_state() {
+
+	pn532_result<pn532_gpio> result;
 	
-	for( size_t i = 8; i < 11; i++ ) {
+	// Pins the library drives itself hold what was last written, only
+	// pins watched as inputs (see watch_gpio_inputs().) need the PN532.
+	if( gpio_known && gpio_input_p3 == 0x00 && gpio_input_p7 == 0x00 ) {
 		
-//		gpio_states[ i - 8 ] = bytes_in[i];
+		result.value.p3 = gpio_p3;
+		result.value.p7 = gpio_p7;
+		result.value.interface = using_i2c ? 0x01 : 0x02;
+		result.status = 0x00;
+		return result;
 		
 	}
+	
+	const uint8_t command[1] = {CC_read_gpio};
+	uint8_t response[3];
+	
+	size_t size_response = 3;
+	write_command( command, 1 );
+	if( !read_response( response, size_response ) || size_response != 3 ) {
+		return result;
+	}
+	
+	result.value.p3 = response[0];
+	result.value.p7 = response[1];
+	result.value.interface = response[2];
+	result.status = 0x00;
+	return result;
 }
 
 /// \brief
@@ -373,8 +779,14 @@ void pn532::read_gpio( std::array<uint8_t, 3> & gpio_states ) {
 /// EN is enable, set this bit high to use this port.
 /// NU means not used, the value on this bit does not matter.
 /// each P number corresponds with a physical port on the board.
+///
+/// Ports that already hold the requested states are not written again, when
+/// nothing changes nothing is sent. See set_pin() to change single pins,
+/// changes staged that way on a port without its EN bit set stay pending.
+/// Returns false when the PN532 did not confirm the write, the states the
+/// library remembers are left as they were in that case.
 
-void pn532::write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 ) {
+bool pn532::write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 ) {
 
 	// Safety check, gpio port 7 is shared with the spi bus, so when using spi, set port 7 to dont touch.
 	if( !using_i2c ) {
@@ -384,17 +796,59 @@ void pn532::write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 ) {
 	// Safety check, p32 and p34 are reserved and must always be high (1).
 	gpio_p3 = gpio_p3 | 0x14;
 	
-	uint8_t LEN = 4;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~( TFI + CC_write_gpio + gpio_p3 + gpio_p7 ) + 1;
+	// Ports the caller writes, only their pending changes are replaced.
+	const bool write_p3 = gpio_p3 & 0x80;
+	const bool write_p7 = gpio_p7 & 0x80;
 	
-	const size_t size_out = 11;
-	const size_t size_in = 9;
-	const uint8_t bytes_out[ size_out ] = {PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI, CC_write_gpio, gpio_p3, gpio_p7, DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
+	// Ports that already hold the requested pins are left out, when
+	// neither port changes the command is not sent at all.
+	const uint8_t new_p3 = gpio_p3 & 0x80 ? gpio_p3 & 0x3F : this->gpio_p3;
+	const uint8_t new_p7 = gpio_p7 & 0x80 ? gpio_p7 & 0x06 : this->gpio_p7;
+	if( gpio_known ) {
+		if( new_p3 == this->gpio_p3 ) {
+			gpio_p3 &= ~0x80;
+		}
+		if( new_p7 == this->gpio_p7 ) {
+			gpio_p7 &= ~0x80;
+		}
+		if( !( gpio_p3 & 0x80 ) && !( gpio_p7 & 0x80 ) ) {
+			sync_pending_gpio( write_p3, write_p7 );
+			return true;
+		}
+	}
 	
-	write( bytes_out, size_out );
-	read( bytes_in, size_in );
+	// WriteGPIO answers with an empty frame.
+	const uint8_t command[3] = {CC_write_gpio, gpio_p3, gpio_p7};
+	uint8_t response[1];
+	size_t size_response = 1;
+	write_command( command, 3 );
+	if( !read_response( response, size_response ) || size_response != 0 ) {
+		return false;
+	}
+	
+	// Port 3 is only known after the constructor has written it.
+	this->gpio_p3 = new_p3;
+	this->gpio_p7 = new_p7;
+	gpio_known = gpio_known || ( gpio_p3 & 0x80 );
+	sync_pending_gpio( write_p3, write_p7 );
+	return true;
+}
+
+/// \brief
+/// Function to drop the pending pin changes of the ports just written.
+/// \details
+/// After write_gpio() the pending states of the ports it was asked to
+/// write are those ports' states again. Changes staged with set_pin(),
+/// clear_pin() or toggle() on the other port are kept for flush_gpio().
+
+void pn532::sync_pending_gpio( const bool & port_p3, const bool & port_p7 ) {
+
+	if( port_p3 ) {
+		gpio_pending_p3 = gpio_p3;
+	}
+	if( port_p7 ) {
+		gpio_pending_p7 = gpio_p7;
+	}
 
 }
 
@@ -406,50 +860,81 @@ void pn532::write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 ) {
 /// its end. The uid gets printed to cout and can then be used in other functions. for
 /// authentication or triggering other actions using the uid, an example of this is
 /// available, see the main.cpp in the implementation folder.
+/// See get_card_uid( card_uid & ) for UID's of any length without padding.
 
 void pn532::get_card_uid( std::array<uint8_t, 7> & uid ) {
 
-	uint8_t MaxTg = 0x01;
-	uint8_t BrTy = 0x00;
-	uint8_t LEN = 4;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~( TFI + CC_get_uid + MaxTg + BrTy ) + 1;
-	
-	const size_t size_out = 11;
-	const size_t size_in = 22;
-	const uint8_t bytes_out[ size_out ] = {PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI, CC_get_uid, MaxTg, BrTy, DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
-		
-	write( bytes_out, size_out );
-	hwlib::cout << "Waiting for NFC card.\n";
-	read_status_byte();
-	hwlib::cout << "NFC card found!\n";
-	read( bytes_in, size_in );
+	PN532_INFO( "Waiting for NFC card.\n" );
+	const pn532_result<pn532_target> result = read_card();
+	PN532_INFO( "NFC card found!\n" );
 	
-	hwlib::cout << "Length of card UID: " << bytes_in[13] << "\n";
-	hwlib::cout << "UID:";
-	if( bytes_in[13] == 4 ) { // Check if the UID length is the most common 4 bytes.
+	PN532_DEBUG( "Length of card UID: " << result.value.uid_size << "\n" );
+	PN532_DEBUG( "UID:" );
+	if( result.value.uid_size == 4 ) { // Check if the UID length is the most common 4 bytes.
 		
-		for( size_t i = 14; i < 18; i++ ) {
+		for( size_t i = 0; i < 4; i++ ) {
 			
-			uid[ i - 14 ] = bytes_in[i];
-			hwlib::cout << hwlib::hex << " " << bytes_in[i];
+			uid[i] = result.value.uid[i];
+			PN532_DEBUG( hwlib::hex << " " << result.value.uid[i] );
 			
 		}
-		hwlib::cout << "\n";
+		PN532_DEBUG( "\n" );
 		// Pad the 4 byte uid with zeros.
 		uid[4] = 0x00; uid[5] = 0x00; uid[6] = 0x00;
 	}
 	else { // Assume a size of 7 bytes.
 		
-		for( size_t i = 14; i < 21; i++ ) {
+		for( size_t i = 0; i < 7; i++ ) {
 			
-			uid[ i - 14 ] = bytes_in[i];
-			hwlib::cout << hwlib::hex << " " << bytes_in[i];
+			uid[i] = result.value.uid[i];
+			PN532_DEBUG( hwlib::hex << " " << result.value.uid[i] );
 			
 		}
-		hwlib::cout << "\n\n";
+		PN532_DEBUG( "\n\n" );
+	}
+}
+
+/// \brief
+/// Function to receive an NFC cards UID without padding.
+/// \details
+/// Same as get_card_uid() above, but UID's of any length are kept as they
+/// are, together with the SENS_RES and SEL_RES of the card. Use
+/// card_uid::key() to compare or store them.
+
+void pn532::get_card_uid( card_uid & uid ) {
+
+	PN532_INFO( "Waiting for NFC card.\n" );
+	uid = card_uid( read_card().value );
+	PN532_INFO( "NFC card found!\n" );
+	
+	PN532_DEBUG( "Length of card UID: " << uid.size() << "\n" );
+	PN532_DEBUG( "UID:" );
+	for( size_t i = 0; i < uid.size(); i++ ) {
+		
+		PN532_DEBUG( hwlib::hex << " " << uid.data()[i] );
+		
+	}
+	PN532_DEBUG( "\n\n" );
+
+}
+
+/// \brief
+/// Function to receive an NFC card with all it told during its activation.
+/// \details
+/// Waits like get_card_uid() but nothing gets printed, value holds the UID
+/// of any size with SENS_RES and SEL_RES, see pn532_target. The card
+/// becomes the active target.
+
+pn532_result<pn532_target> pn532::read_card() {
+
+	const uint8_t command[3] = {CC_get_uid, 0x01, brty_106a};
+	pn532_result<pn532_target> result;
+	
+	write_command( command, 3 );
+	if( read_target( result.value ) ) {
+		result.status = 0x00;
 	}
+	return result;
 }
 
 /// \brief
@@ -465,83 +950,2750 @@ void pn532::get_card_uid( std::array<uint8_t, 7> & uid ) {
 
 void pn532::read_eeprom_block( const uint8_t blocknr ) {
 	
-	uint8_t LEN = 5;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~( TFI + CC_data_exchange + target_card + mifare_read + blocknr ) + 1;
-	
-	const size_t size_out = 12;
-	const size_t size_in = 28;
-	const uint8_t bytes_out[ size_out ] = {PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI, CC_data_exchange, target_card, mifare_read, blocknr, DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
-		
-	write( bytes_out, size_out );
-	read_status_byte();
-	read( bytes_in, size_in );
+	const pn532_result<std::array<uint8_t, 16>> result = read_block( blocknr );
 	
-	if( bytes_in[10] != 0x00 ) {
-		hwlib::cout << "Something went wrong!\n The displayed data is therefor probably false.\n";
+	if( !result.ok() ) {
+		PN532_ERROR( "Something went wrong!\n The displayed data is therefor probably false.\n" );
 	}
 	
-	hwlib::cout << hwlib::hex << "block number 0x" << blocknr << " has been read:\n";
-	for(size_t i = 11; i < 27; i++) {
+	PN532_DEBUG( hwlib::hex << "block number 0x" << blocknr << " has been read:\n" );
+	for(size_t i = 0; i < 15; i++) {
 		
-		hwlib::cout << hwlib::hex << " 0x" << bytes_in[i] << " :";
+		PN532_DEBUG( hwlib::hex << " 0x" << result.value[i] << " :" );
 		
 	}
 	
-	hwlib::cout << hwlib::hex << " 0x" << bytes_in[27] << "\n";
+	PN532_DEBUG( hwlib::hex << " 0x" << result.value[15] << "\n" );
 
 }
 
 /// \brief
-/// Function to write to an nfc cards eeprom.
+/// Function to read an nfc cards eeprom block into an array.
 /// \details
-/// This function received which block number you wish to write to and
-/// a 16 byte array of the data to write. It's important to leave
-/// the NFC card on the reader untill the all clear message to ensure the data
-/// is read properly.
+/// This function reads the given block number and places its 16 bytes into
+/// data, nothing gets printed to console. Returns false when the card
+/// reported an error, data is left untouched in that case.
 ///
 /// \warning
 /// The highest possible block number for a 1K card is 63 and 255 for a 4K card!
 
-void pn532::write_eeprom_block( const uint8_t blocknr, const std::array<uint8_t, 16> & data ) {
+bool pn532::read_eeprom_block( const uint8_t blocknr, std::array<uint8_t, 16> & data ) {
 
-	hwlib::cout << "Do not move the NFC card during this command!\n";
-	
-	uint8_t LEN = 5;
-	uint8_t LCS = ~LEN + 1;
-	uint8_t DCS = ~( TFI + CC_data_exchange + target_card + mifare_write + blocknr +
-					 data[0] + data[1] + data[2] + data[3] + data[4] + data[5] +
-					 data[6] + data[7] + data[8] + data[9] + data[10] + data[11] +
-					 data[12] + data[13] + data[14] + data[15] ) + 1;
-	
-	const size_t size_out = 28;
-	const size_t size_in = 28;
-	const uint8_t bytes_out[ size_out ] = { PREAMBLE, START_CODE_1, START_CODE_2, LEN, LCS, TFI,
-											CC_data_exchange, target_card, mifare_read, blocknr,
-											data[0], data[1], data[2], data[3], data[4], data[5],
-											data[6], data[7], data[8], data[9], data[10], data[11],
-											data[12], data[13], data[14], data[15], DCS, POSTAMBLE};
-	uint8_t bytes_in[ size_in ];
-		
-	write( bytes_out, size_out );
-	read_status_byte();
-	read( bytes_in, size_in );
+	const pn532_result<std::array<uint8_t, 16>> result = read_block( blocknr );
+	if( !result.ok() ) {
+		return false;
+	}
 	
-	hwlib::cout << hwlib::hex << "\nNFC card can safely be removed.\n\n";
-
+	data = result.value;
+	return true;
 }
 
-void pn532::read_eeprom_all() {
+/// \brief
+/// Function to read an nfc cards eeprom block.
+/// \details
+/// status is the status byte of the PN532 for the card's answer, a block
+/// of another size than 16 bytes gives status_no_frame.
+///
+/// \warning
+/// The highest possible block number for a 1K card is 63 and 255 for a 4K card!
+
+pn532_result<std::array<uint8_t, 16>> pn532::read_block( const uint8_t blocknr ) {
+
+	const uint8_t command[2] = {mifare_read, blocknr};
+	uint8_t response[16];
+	size_t size_response = 16;
+	pn532_result<std::array<uint8_t, 16>> result;
 	
-	hwlib::cout << "Do not move the NFC card during this command!\n";
+	result.status = data_exchange( command, 2, response, size_response );
+	if( result.status == 0x00 && size_response != 16 ) {
+		result.status = status_no_frame;
+	}
+	if( !result.ok() ) {
+		return result;
+	}
 	
-	for( size_t i = 0; i < 64; i++ ) {
+	for( size_t i = 0; i < 16; i++ ) {
 		
-		read_eeprom_block( i );
+		result.value[i] = response[i];
 		
 	}
-	
-	hwlib::cout << "\nNFC card can safely be removed.\n\n";
+	return result;
+}
+
+/// \brief
+/// Function to write to an nfc cards eeprom.
+/// \details
+/// This function received which block number you wish to write to and
+/// a 16 byte array of the data to write. It's important to leave
+/// the NFC card on the reader untill the all clear message to ensure the data
+/// is read properly. Returns the status byte of the PN532, 0x00 means the
+/// card accepted the data.
+///
+/// \warning
+/// The highest possible block number for a 1K card is 63 and 255 for a 4K card!
+
+uint8_t pn532::write_eeprom_block( const uint8_t blocknr, const std::array<uint8_t, 16> & data ) {
+
+	PN532_INFO( "Do not move the NFC card during this command!\n" );
+	
+	uint8_t command[18] = {mifare_write, blocknr};
+	for( size_t i = 0; i < 16; i++ ) {
+		
+		command[ i + 2 ] = data[i];
+		
+	}
+	uint8_t response[1];
+	size_t size_response = 0;
+	
+	const uint8_t status = data_exchange( command, 18, response, size_response );
+	if( status != 0x00 ) {
+		PN532_ERROR( "Something went wrong!\n The data has probably not been written.\n" );
+	}
+	
+	PN532_INFO( hwlib::hex << "\nNFC card can safely be removed.\n\n" );
+	return status;
+}
+
+void pn532::read_eeprom_all() {
+	
+	PN532_INFO( "Do not move the NFC card during this command!\n" );
+	
+	for( size_t i = 0; i < 64; i++ ) {
+		
+		read_eeprom_block( i );
+		
+	}
+	
+	PN532_INFO( "\nNFC card can safely be removed.\n\n" );
+
+}
+
+/// \brief
+/// Function to authenticate a MIFARE Classic sector.
+/// \details
+/// This function authenticates the sector that holds blocknr with the given
+/// 6 byte key, key A is used unless use_key_b is set. The UID of the card
+/// found by the last get_card_uid() call is used, for 7 and 10 byte UID's
+/// its last 4 bytes are used as the card specifies.
+/// Authentication stays valid until another sector is authenticated or
+/// the card leaves the field.
+
+bool pn532::authenticate_block( const uint8_t blocknr, const std::array<uint8_t, 6> & key, const bool use_key_b ) {
+
+	if( target_active.uid_size < 4 ) {
+		return false;
+	}
+	
+	uint8_t command[12] = {use_key_b ? (uint8_t) mifare_auth_b : (uint8_t) mifare_auth_a, blocknr};
+	for( size_t i = 0; i < 6; i++ ) {
+		
+		command[ i + 2 ] = key[i];
+		
+	}
+	for( size_t i = 0; i < 4; i++ ) {
+		
+		command[ i + 8 ] = target_active.uid[ target_active.uid_size - 4 + i ];
+		
+	}
+	
+	uint8_t response[1];
+	size_t size_response = 0;
+	return data_exchange( command, 12, response, size_response ) == 0x00;
+}
+
+/// \brief
+/// Function to encode a value into the MIFARE value block format.
+/// \details
+/// A value block holds a signed 32 bit value three times (once inverted) and
+/// a 1 byte address four times (twice inverted), all little endian:
+///
+/// value, ~value, value, addr, ~addr, addr, ~addr
+///
+/// The address is not used by the card itself, it is commonly set to the
+/// block number so a backup block can be traced back to its origin.
+
+void pn532::encode_value_block( const int32_t value, const uint8_t addr, std::array<uint8_t, 16> & data ) {
+
+	const uint32_t raw = value;
+	for( size_t i = 0; i < 4; i++ ) {
+		
+		uint8_t byte = raw >> ( 8 * i );
+		data[i] = byte;
+		data[ i + 4 ] = ~byte;
+		data[ i + 8 ] = byte;
+		
+	}
+	data[12] = addr;
+	data[13] = ~addr;
+	data[14] = addr;
+	data[15] = ~addr;
+
+}
+
+/// \brief
+/// Function to decode a MIFARE value block.
+/// \details
+/// This function checks the redundancy of the value block format described at
+/// encode_value_block(), false is returned when data is not a valid value block.
+
+bool pn532::decode_value_block( const std::array<uint8_t, 16> & data, int32_t & value, uint8_t & addr ) {
+
+	uint32_t raw = 0;
+	for( size_t i = 0; i < 4; i++ ) {
+		
+		if( data[i] != data[ i + 8 ] || data[i] != (uint8_t) ~data[ i + 4 ] ) {
+			return false;
+		}
+		raw |= uint32_t( data[i] ) << ( 8 * i );
+		
+	}
+	if( data[12] != data[14] || data[13] != data[15] || data[12] != (uint8_t) ~data[13] ) {
+		return false;
+	}
+	
+	value = raw;
+	addr = data[12];
+	return true;
+}
+
+/// \brief
+/// Function to format a block as a value block.
+/// \details
+/// This function writes value to blocknr in the value block format, the
+/// block number itself is used as the address byte. The sector must be
+/// authenticated first, see authenticate_block().
+
+bool pn532::format_value_block( const uint8_t blocknr, const int32_t value ) {
+
+	std::array<uint8_t, 16> data;
+	encode_value_block( value, blocknr, data );
+	
+	uint8_t command[18] = {mifare_write, blocknr};
+	for( size_t i = 0; i < 16; i++ ) {
+		
+		command[ i + 2 ] = data[i];
+		
+	}
+	uint8_t response[1];
+	size_t size_response = 0;
+	return data_exchange( command, 18, response, size_response ) == 0x00;
+}
+
+/// \brief
+/// Function to read the value of a value block.
+/// \details
+/// Returns false when the block could not be read or is not formatted as a
+/// value block. The sector must be authenticated first.
+
+bool pn532::read_value_block( const uint8_t blocknr, int32_t & value ) {
+
+	std::array<uint8_t, 16> data;
+	uint8_t addr;
+	return read_eeprom_block( blocknr, data ) && decode_value_block( data, value, addr );
+}
+
+/// \brief
+/// Function to send a value block operation to the card.
+/// \details
+/// INCREMENT, DECREMENT and RESTORE take a 4 byte little endian operand,
+/// the PN532 takes care of the two part MIFARE handshake so every operation
+/// costs a single exchange. Returns the status byte of the PN532.
+
+uint8_t pn532::value_operation( const uint8_t operation, const uint8_t blocknr, const uint32_t operand ) {
+
+	const uint8_t command[6] = {operation, blocknr, (uint8_t) operand, (uint8_t)( operand >> 8 ),
+								(uint8_t)( operand >> 16 ), (uint8_t)( operand >> 24 )};
+	uint8_t response[1];
+	size_t size_response = 0;
+	return data_exchange( command, operation == mifare_transfer ? 2 : 6, response, size_response );
+}
+
+/// \brief
+/// Function to increment a value block.
+/// \details
+/// The value of blocknr plus delta is stored in the transfer buffer of the
+/// card, nothing is written until transfer_value() is called. A counter
+/// update on an authenticated sector is therefor two exchanges:
+/// increment_value( block, 1 ) followed by transfer_value( block ), the card
+/// guarantees that the block either holds the old or the new value.
+
+bool pn532::increment_value( const uint8_t blocknr, const uint32_t delta ) {
+
+	return value_operation( mifare_increment, blocknr, delta ) == 0x00;
+}
+
+/// \brief
+/// Function to decrement a value block.
+/// \details
+/// The value of blocknr minus delta is stored in the transfer buffer of the
+/// card, see increment_value().
+
+bool pn532::decrement_value( const uint8_t blocknr, const uint32_t delta ) {
+
+	return value_operation( mifare_decrement, blocknr, delta ) == 0x00;
+}
+
+/// \brief
+/// Function to copy a value block into the transfer buffer.
+/// \details
+/// Combined with transfer_value() to another block of the same sector this
+/// makes a backup of a value block, see increment_value().
+
+bool pn532::restore_value( const uint8_t blocknr ) {
+
+	return value_operation( mifare_restore, blocknr, 0 ) == 0x00;
+}
+
+/// \brief
+/// Function to write the transfer buffer to a value block.
+/// \details
+/// This commits the result of increment_value(), decrement_value() or
+/// restore_value() to blocknr.
+
+bool pn532::transfer_value( const uint8_t blocknr ) {
+
+	return value_operation( mifare_transfer, blocknr, 0 ) == 0x00;
+}
+
+/// \brief
+/// Function to send an APDU to an ISO14443-4 (ISO-DEP) card.
+/// \details
+/// This function sends apdu[] to the card found by the last get_card_uid()
+/// call and places the response data in response[], without the status
+/// word, which is returned separately (0x9000 means success.). size_response
+/// holds the size of response[] when calling and the amount of data bytes
+/// after. The PN532 takes care of the ISO14443-4 block protocol and
+/// data_exchange() of frame chaining, so APDU's and responses of any length
+/// that fits the caller's buffers are handled without splitting them by hand.
+/// The status byte of the PN532 is returned, 0x00 means success.
+
+uint8_t pn532::apdu_transceive( const uint8_t apdu[], const size_t & size_apdu, uint8_t response[], size_t & size_response, uint16_t & status_word ) {
+
+	status_word = 0x0000;
+	if( !( target_active.sel_res & SAK_iso_dep ) ) {
+		size_response = 0;
+		return status_no_frame;
+	}
+	
+	uint8_t status = data_exchange( apdu, size_apdu, response, size_response );
+	if( status != 0x00 || size_response < 2 ) {
+		return status;
+	}
+	
+	size_response -= 2;
+	status_word = ( response[ size_response ] << 8 ) | response[ size_response + 1 ];
+	return status;
+}
+
+/// \brief
+/// Function to raise the bit rate used with an ISO14443-4 card.
+/// \details
+/// This function reads which bit rates the active card supports in both
+/// directions from the TA(1) byte of its ATS and switches to the highest
+/// one that is not above bit_rate_max using InPSL. Large reads at 424 kbps
+/// spend a quarter of the RF time they would at the default 106 kbps.
+/// The bit rate in use afterwards is returned, BR_106 when the card does not
+/// support anything faster or the switch failed. The bit rate falls back to
+/// BR_106 every time a new card is found by get_card_uid().
+
+uint8_t pn532::negotiate_bit_rate( const uint8_t bit_rate_max ) {
+
+	// ATS format: TL, T0, TA(1), TB(1), TC(1), historical bytes. T0 bit 5 tells TA(1) is present.
+	if( !( target_active.sel_res & SAK_iso_dep ) || target_active.ats_size < 3 || !( target_active.ats[1] & 0x10 ) ) {
+		return target_active.bit_rate;
+	}
+	
+	// TA(1) bits 1 and 2: 212 and 424 kbps reader to card (DR), bits 5 and 6: card to reader (DS).
+	const uint8_t TA1 = target_active.ats[2];
+	uint8_t bit_rate = BR_106;
+	if( bit_rate_max >= BR_424 && ( TA1 & 0x02 ) && ( TA1 & 0x20 ) ) {
+		bit_rate = BR_424;
+	}
+	else if( bit_rate_max >= BR_212 && ( TA1 & 0x01 ) && ( TA1 & 0x10 ) ) {
+		bit_rate = BR_212;
+	}
+	
+	if( bit_rate == target_active.bit_rate ) {
+		return target_active.bit_rate;
+	}
+	
+	const uint8_t command[4] = {CC_psl, target_active.tg, bit_rate, bit_rate};
+	uint8_t response[1];
+	size_t size_response = 1;
+	write_command( command, 4 );
+	if( read_response( response, size_response ) && size_response == 1 && ( response[0] & 0x3F ) == 0x00 ) {
+		target_active.bit_rate = bit_rate;
+	}
+	raw_settings_known = false;
+	return target_active.bit_rate;
+}
+
+/// \brief
+/// Function to read the answer to InListPassiveTarget.
+/// \details
+/// This function reads the response of an InListPassiveTarget command for
+/// the card type brty into target: its logical number and everything the
+/// card told about itself. For type A cards that is SENS_RES, SEL_RES, UID
+/// and, for ISO14443-4 cards which the PN532 activates itself, the ATS.
+/// For FeliCa cards that is the IDm (kept in uid.) and PMm, for Jewel cards
+/// SENS_RES and the 4 byte JEWELID (kept in uid.) The card becomes
+/// the active target. Returns false when no card was found, target.tg is
+/// 0 in that case.
+
+bool pn532::read_target( pn532_target & target, const uint8_t brty ) {
+
+	// NbTg, Tg, target data.
+	uint8_t response[ 16 + ATS_MAX ];
+	size_t size_response = sizeof( response );
+	read_response( response, size_response );
+	
+	target = pn532_target();
+	target.brty = brty;
+	bool found = size_response >= 3 && response[0] != 0;
+	
+	// Activation lets the PN532 set up the CIU again, the raw settings are unknown after.
+	raw_settings_known = false;
+	
+	if( found && ( brty == brty_felica_212 || brty == brty_felica_424 ) ) {
+		
+		// POL_RES length, response code, IDm, PMm, optional system code.
+		found = size_response >= 20 && response[2] >= 18;
+		target.bit_rate = brty == brty_felica_212 ? BR_212 : BR_424;
+		target.uid_size = 8;
+		for( size_t i = 0; found && i < 8; i++ ) {
+			
+			target.uid[i] = response[ i + 4 ];
+			target.pmm[i] = response[ i + 12 ];
+			
+		}
+		
+	}
+	else if( found && brty == brty_jewel ) {
+		
+		// SENS_RES, JEWELID.
+		found = size_response >= 8;
+		target.sens_res = ( response[2] << 8 ) | response[3];
+		target.uid_size = 4;
+		for( size_t i = 0; found && i < 4; i++ ) {
+			
+			target.uid[i] = response[ i + 4 ];
+			
+		}
+		
+	}
+	else if( found ) {
+		
+		// SENS_RES, SEL_RES, NFCIDLength, NFCID, ATS.
+		found = size_response >= 6 && size_response >= size_t( 6 + response[5] );
+		target.sens_res = ( response[2] << 8 ) | response[3];
+		target.sel_res = response[4];
+		target.uid_size = response[5] < target.uid.size() ? response[5] : target.uid.size();
+		for( size_t i = 0; found && i < target.uid_size; i++ ) {
+			
+			target.uid[i] = response[ i + 6 ];
+			
+		}
+		
+		// ISO14443-4 cards are activated by the PN532, their ATS follows the UID.
+		if( found && ( target.sel_res & SAK_iso_dep ) ) {
+			
+			const size_t ats_start = 6 + response[5];
+			for( size_t i = 0; ats_start < size_response && i < response[ ats_start ] && i < ATS_MAX && ats_start + i < size_response; i++ ) {
+				
+				target.ats[ target.ats_size++ ] = response[ ats_start + i ];
+				
+			}
+		}
+	}
+	
+	if( !found ) {
+		target = pn532_target();
+		target_active = target;
+		target_selected = false;
+		return false;
+	}
+	
+	target.tg = response[1];
+	target_active = target;
+	target_selected = true;
+	return true;
+}
+
+/// \brief
+/// Function to send a command that only takes a logical target number.
+/// \details
+/// Used for InSelect, InDeselect and InRelease, returns the status byte of
+/// the PN532, 0x00 means success.
+
+uint8_t pn532::target_command( const uint8_t command_code, const uint8_t tg ) {
+
+	const uint8_t command[2] = {command_code, tg};
+	uint8_t response[1];
+	size_t size_response = 1;
+	write_command( command, 2 );
+	if( !read_response( response, size_response ) || size_response != 1 ) {
+		return status_no_frame;
+	}
+	return response[0] & 0x3F;
+}
+
+/// \brief
+/// Function to activate a card and receive its handle.
+/// \details
+/// This function waits for a type A card to enter the pn532's range, just
+/// like get_card_uid(), but prints nothing and fills target with everything
+/// the card told during its activation. The card becomes the active target,
+/// all card commands are sent to it until another target is activated.
+
+bool pn532::list_target( pn532_target & target ) {
+
+	start_list_target();
+	return finish_list_target( target );
+}
+
+/// \brief
+/// Function to start waiting for a type A card without blocking.
+/// \details
+/// Sends the InListPassiveTarget of list_target() and returns as soon as
+/// the PN532 acknowledged it. The bus is free while the PN532 waits for a
+/// card: poll response_ready() and call finish_list_target() once it is
+/// true. No other command may be sent to this PN532 in between.
+
+void pn532::start_list_target() {
+
+	const uint8_t command[3] = {CC_get_uid, 0x01, brty_106a};
+	write_command( command, 3 );
+
+}
+
+/// \brief
+/// Function to read the answer to start_list_target(), see list_target().
+/// \details
+/// Waits when the answer is not ready yet.
+
+bool pn532::finish_list_target( pn532_target & target ) {
+
+	return read_target( target );
+}
+
+/// \brief
+/// Function to activate a card of which the UID is known.
+/// \details
+/// This function passes uid (4, 7 or 10 bytes.) to InListPassiveTarget as
+/// initiator data, with the cascade tag (0x88.) in front of every cascade
+/// level but the last as ISO14443-3 asks, so the PN532 selects that card
+/// directly instead of running the anticollision cycle. Useful for a re-tap
+/// or a card in a fixed slot. Other cards in the field are left alone. Like
+/// list_target() it waits as long as set_passive_retries() allows. Returns
+/// false when the card did not answer or, as a cheap check on top, when the
+/// UID it reported differs from uid.
+
+bool pn532::list_target( pn532_target & target, const uint8_t uid[], const size_t & size_uid ) {
+
+	if( size_uid != 4 && size_uid != 7 && size_uid != 10 ) {
+		return false;
+	}
+	
+	// 7 bytes: CT U0 U1 U2 U3..U6, 10 bytes: CT U0 U1 U2 CT U3..U9.
+	uint8_t command[15] = {CC_get_uid, 0x01, brty_106a};
+	size_t size_command = 3;
+	for( size_t i = 0; i < size_uid; i++ ) {
+		
+		if( ( i == 0 && size_uid > 4 ) || ( i == 3 && size_uid == 10 ) ) {
+			command[ size_command++ ] = cascade_tag;
+		}
+		command[ size_command++ ] = uid[i];
+		
+	}
+	write_command( command, size_command );
+	if( !read_target( target ) ) {
+		return false;
+	}
+	
+	bool match = target.uid_size == size_uid;
+	for( size_t i = 0; i < size_uid && match; i++ ) {
+		
+		match = target.uid[i] == uid[i];
+		
+	}
+	return match;
+}
+
+/// \brief
+/// Function to make a known card the active target again.
+/// \details
+/// When target is still the selected card nothing is sent at all, so a
+/// transaction of several commands on one card costs no extra exchanges.
+/// A card that was deselected or lost its selection because it did not
+/// answer in time is selected again with InSelect, which is much cheaper
+/// than a new anticollision cycle. Returns false when the card has left
+/// the field, the PN532 forgets it in that case and the card has to be
+/// found again with list_target().
+
+bool pn532::activate_target( const pn532_target & target ) {
+
+	if( target.tg == 0 ) {
+		return false;
+	}
+	if( target_selected && target_active.tg == target.tg ) {
+		return true;
+	}
+	
+	if( target_command( CC_in_select, target.tg ) != 0x00 ) {
+		target_command( CC_in_release, target.tg );
+		target_active = pn532_target();
+		target_selected = false;
+		return false;
+	}
+	
+	target_active = target;
+	target_active.bit_rate = BR_106;
+	target_selected = true;
+	return true;
+}
+
+/// \brief
+/// Function to deselect the active target.
+/// \details
+/// The card is put to sleep (HLTA or S(DESELECT).) but the PN532 keeps its
+/// information, so activate_target() can wake it up again later.
+
+bool pn532::deselect_target() {
+
+	if( target_active.tg == 0 ) {
+		return false;
+	}
+	target_selected = false;
+	return target_command( CC_in_deselect, target_active.tg ) == 0x00;
+}
+
+/// \brief
+/// Function to release the active target.
+/// \details
+/// The card is put to sleep and the PN532 forgets it, its handle can not
+/// be activated again.
+
+bool pn532::release_target() {
+
+	if( target_active.tg == 0 ) {
+		return false;
+	}
+	const uint8_t tg = target_active.tg;
+	target_active = pn532_target();
+	target_selected = false;
+	return target_command( CC_in_release, tg ) == 0x00;
+}
+
+/// \brief
+/// Function to check if the active target is still in the field.
+/// \details
+/// ISO14443-4 cards are checked with the attention request test of
+/// Diagnose, which sends a single R(NAK) or presence check block and
+/// leaves the card's state alone. Other cards have no such block, they are
+/// put to sleep with InDeselect and woken with InSelect, which still avoids
+/// the anticollision cycle and blocking wait of a full poll but ends a
+/// MIFARE authentication. A card that is gone is released.
+
+bool pn532::target_present() {
+
+	if( target_active.tg == 0 ) {
+		return false;
+	}
+	
+	if( target_active.sel_res & SAK_iso_dep ) {
+		
+		const uint8_t command[2] = {CC_diagnose, diagnose_attention};
+		uint8_t response[1];
+		size_t size_response = 1;
+		write_command( command, 2 );
+		if( read_response( response, size_response ) && size_response >= 1 && ( response[0] & 0x3F ) == 0x00 ) {
+			return true;
+		}
+		release_target();
+		return false;
+		
+	}
+	
+	const pn532_target target = target_active;
+	deselect_target();
+	return activate_target( target );
+}
+
+/// \brief
+/// Function to set how often check_presence() talks to the card.
+/// \details
+/// The default is 100 ms, calls to check_presence() within this interval
+/// of the last real check are answered without any bus traffic.
+
+void pn532::set_presence_interval( const uint32_t interval_ms ) {
+
+	presence_interval_us = uint_fast64_t( interval_ms ) * 1000;
+
+}
+
+/// \brief
+/// Function to follow whether the active target is still in the field.
+/// \details
+/// Meant to be called from a main loop: the card is only checked with
+/// target_present() once every presence interval, see
+/// set_presence_interval(), so a door controller can notice a card leaving
+/// and re-arm quickly without flooding the bus.
+
+card_presence pn532::check_presence() {
+
+	if( target_active.tg == 0 ) {
+		return card_presence::absent;
+	}
+	
+	const uint_fast64_t now = hwlib::now_us();
+	if( now - presence_checked_us < presence_interval_us ) {
+		return card_presence::present;
+	}
+	presence_checked_us = now;
+	
+	return target_present() ? card_presence::present : card_presence::removed;
+}
+
+/// \brief
+/// Function to activate a FeliCa card and receive its handle.
+/// \details
+/// This function waits for a FeliCa card with the given system code to
+/// enter the pn532's range, at 212 or 424 kbps depending on brty. The
+/// default system code 0xFFFF matches every card, a transit system code
+/// (0x0003 for example.) skips cards of other systems. The card becomes the
+/// active target, see list_target().
+
+bool pn532::list_felica_target( pn532_target & target, const uint16_t system_code, const uint8_t brty ) {
+
+	// Polling: command code, system code, request code (none.), time slot (1 slot.)
+	const uint8_t command[8] = {CC_get_uid, 0x01, brty, felica_polling, (uint8_t)( system_code >> 8 ), (uint8_t) system_code, 0x00, 0x00};
+	write_command( command, 8 );
+	return read_target( target, brty );
+}
+
+/// \brief
+/// Function to read FeliCa blocks without encryption.
+/// \details
+/// This function reads number_of_blocks blocks of the service service_code
+/// from the active FeliCa target into data[], which must hold 16 bytes per
+/// block. Up to blocks_per_exchange blocks are requested with a single
+/// Read Without Encryption, most cards accept FELICA_BLOCKS_MAX (15.) so a
+/// transit history of 20 blocks costs 2 exchanges instead of 20. Check the
+/// specification of the card when it allows fewer. Returns false when the
+/// card did not answer or reported an error in its status flags.
+
+bool pn532::felica_read( const uint16_t service_code, const uint16_t blocks[], const size_t & number_of_blocks, uint8_t data[], const size_t & blocks_per_exchange ) {
+
+	if( target_active.brty != brty_felica_212 && target_active.brty != brty_felica_424 ) {
+		return false;
+	}
+	
+	const size_t blocks_max = blocks_per_exchange == 0 || blocks_per_exchange > FELICA_BLOCKS_MAX ? FELICA_BLOCKS_MAX : blocks_per_exchange;
+	size_t done = 0;
+	while( done < number_of_blocks ) {
+		
+		const size_t count = number_of_blocks - done < blocks_max ? number_of_blocks - done : blocks_max;
+		
+		// Length, command code, IDm, 1 service, service code (little endian.), block count, block list.
+		uint8_t command[ 14 + 3 * FELICA_BLOCKS_MAX ] = {0x00, felica_read_no_enc};
+		size_t size_command = 2;
+		for( size_t i = 0; i < 8; i++ ) {
+			
+			command[ size_command++ ] = target_active.uid[i];
+			
+		}
+		command[ size_command++ ] = 0x01;
+		command[ size_command++ ] = service_code;
+		command[ size_command++ ] = service_code >> 8;
+		command[ size_command++ ] = count;
+		for( size_t i = 0; i < count; i++ ) {
+			
+			// 2 byte block list elements fit block numbers below 256, others need 3 bytes.
+			const uint16_t blocknr = blocks[ done + i ];
+			if( blocknr < 0x100 ) {
+				command[ size_command++ ] = 0x80;
+				command[ size_command++ ] = blocknr;
+			}
+			else {
+				command[ size_command++ ] = 0x00;
+				command[ size_command++ ] = blocknr;
+				command[ size_command++ ] = blocknr >> 8;
+			}
+			
+		}
+		command[0] = size_command;
+		
+		// Length, response code, IDm, status flag 1 and 2, block count, block data.
+		uint8_t response[ 13 + 16 * FELICA_BLOCKS_MAX ];
+		size_t size_response = sizeof( response );
+		if( data_exchange( command, size_command, response, size_response ) != 0x00 ) {
+			return false;
+		}
+		
+		// A card reporting an error in status flag 1 or 2 leaves out the block count and data.
+		if( size_response < 12 || response[1] != felica_read_no_enc + 1 || response[10] != 0x00 || response[11] != 0x00 ) {
+			return false;
+		}
+		for( size_t i = 0; i < 8; i++ ) {
+			
+			if( response[ i + 2 ] != target_active.uid[i] ) {
+				return false;
+			}
+			
+		}
+		if( size_response < 13 + 16 * count || response[12] != count ) {
+			return false;
+		}
+		
+		for( size_t i = 0; i < 16 * count; i++ ) {
+			
+			data[ 16 * done + i ] = response[ 13 + i ];
+			
+		}
+		done += count;
+		
+	}
+	return true;
+}
+
+/// \brief
+/// Function to activate a Jewel / Topaz card and receive its handle.
+/// \details
+/// This function waits for a Jewel / Topaz (NFC Forum type 1.) card to
+/// enter the pn532's range. The card becomes the active target, see
+/// list_target().
+
+bool pn532::list_jewel_target( pn532_target & target ) {
+
+	const uint8_t command[3] = {CC_get_uid, 0x01, brty_jewel};
+	write_command( command, 3 );
+	return read_target( target, brty_jewel );
+}
+
+/// \brief
+/// Function to dump a Jewel / Topaz card.
+/// \details
+/// This function sends READALL to the active Jewel target, which answers
+/// with its 2 byte header ROM (HR0 in the high byte.) and all 120 bytes of
+/// static memory in a single exchange, instead of 120 single byte reads.
+/// Returns false when the card did not answer completely.
+
+bool pn532::jewel_read_all( std::array<uint8_t, JEWEL_MEMORY_SIZE> & data, uint16_t & header_rom ) {
+
+	if( target_active.brty != brty_jewel ) {
+		return false;
+	}
+	
+	// Command, address, data (both unused.) and the UID, the PN532 adds the CRC.
+	const uint8_t command[7] = {jewel_rall, 0x00, 0x00, target_active.uid[0], target_active.uid[1], target_active.uid[2], target_active.uid[3]};
+	uint8_t response[ 2 + JEWEL_MEMORY_SIZE ];
+	size_t size_response = sizeof( response );
+	if( data_exchange( command, 7, response, size_response ) != 0x00 || size_response != sizeof( response ) ) {
+		return false;
+	}
+	
+	header_rom = ( response[0] << 8 ) | response[1];
+	for( size_t i = 0; i < JEWEL_MEMORY_SIZE; i++ ) {
+		
+		data[i] = response[ i + 2 ];
+		
+	}
+	return true;
+}
+
+// ==========================================================================
+
+// Constant parts of the NDEF type 4 tag emulation, these never change so
+// their TgSetData frames are written out in full and stay in flash.
+
+/// SELECT of the NDEF tag application (D2760000850101.)
+static const uint8_t apdu_select_ndef_app[] = {0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+
+/// SELECT of the capability container file (E103.)
+static const uint8_t apdu_select_cc[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03};
+
+/// READ BINARY of the whole capability container.
+static const uint8_t apdu_read_cc[] = {0x00, 0xB0, 0x00, 0x00, 0x0F};
+
+/// SELECT of the NDEF file (E104.)
+static const uint8_t apdu_select_ndef[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04};
+
+/// TgSetData frame answering 90 00. (Success.)
+static const uint8_t frame_sw_ok[] = {0x00, 0x00, 0xFF, 0x04, 0xFC, 0xD4, 0x8E, 0x90, 0x00, 0x0E, 0x00};
+
+/// TgSetData frame answering 6A 82. (File or application not found.)
+static const uint8_t frame_sw_not_found[] = {0x00, 0x00, 0xFF, 0x04, 0xFC, 0xD4, 0x8E, 0x6A, 0x82, 0xB2, 0x00};
+
+/// TgSetData frame answering the capability container and 90 00: mapping version 2.0,
+/// MLe and MLc NDEF_TAG_CHUNK, NDEF file E104 of NDEF_TAG_MESSAGE_MAX + 2 bytes, read only.
+static const uint8_t frame_cc[] = {0x00, 0x00, 0xFF, 0x13, 0xED, 0xD4, 0x8E, 0x00, 0x0F, 0x20, 0x00, 0x80, 0x00, 0x80,
+								   0x04, 0x06, 0xE1, 0x04, 0x01, 0x00, 0x00, 0xFF, 0x90, 0x00, 0xF0, 0x00};
+
+/// \brief
+/// Function to let the PN532 act as an ISO14443-4 card.
+/// \details
+/// This function enables ISO14443-4 card emulation with set_parameters() and
+/// waits with TgInitAsTarget until a reader in range has activated the
+/// PN532 as a type A card with the given 3 byte NFCID1 (the PN532 adds the
+/// fixed first byte 0x08.) Returns false when the reader did not activate
+/// it as an ISO14443-4 card.
+
+bool pn532::init_as_target( const std::array<uint8_t, 3> & nfcid1 ) {
+
+	pn532_parameters parameters = parameters_active;
+	parameters.iso14443_4_picc = true;
+	parameters.automatic_atr_res = true;
+	set_parameters( parameters );
+	uint8_t response[ 64 ];
+	
+	// Mode (passive and PICC only.), SENS_RES, NFCID1, SEL_RES (ISO14443-4.),
+	// FeliCa parameters and NFCID3 (both unused.), no general and historical bytes.
+	uint8_t command[38] = {CC_tg_init_as_target, 0x05, 0x04, 0x00, nfcid1[0], nfcid1[1], nfcid1[2], SAK_iso_dep};
+	write_command( command, 38 );
+	
+	// Mode the PN532 was activated in (bit 4 is ISO14443-4.), followed by the first command of the reader.
+	size_t size_response = sizeof( response );
+	return read_response( response, size_response ) && size_response >= 1 && ( response[0] & 0x08 );
+}
+
+/// \brief
+/// Function to answer a reader from a response table.
+/// \details
+/// After init_as_target() this function keeps receiving commands of the
+/// reader with TgGetData and answers each with the frame of the first entry
+/// of table[] that matches, or with 6A 82 when none does. No answer is built
+/// while the reader waits: finding the entry and writing its frame is all
+/// that happens per command. Entries can depend on and change the selected
+/// file, see emulation_response. Returns true when the reader released the
+/// PN532, false when the link broke down otherwise.
+
+bool pn532::emulate_target( const emulation_response table[], const size_t & size_table ) {
+
+	uint16_t file = 0;
+	uint8_t bytes_in[ EXCHANGE_DATA_MAX + 1 ];
+	const uint8_t get_data[1] = {CC_tg_get_data};
+	
+	// Only as much of a command is read as the longest entry compares.
+	size_t size_longest = 0;
+	for( size_t i = 0; i < size_table; i++ ) {
+		
+		if( table[i].size_command > size_longest ) {
+			size_longest = table[i].size_command;
+		}
+		
+	}
+	
+	while( true ) {
+		
+		// Status byte followed by the command APDU of the reader.
+		write_command( get_data, 1 );
+		size_t size_in = exchange_room( size_longest, 0 );
+		if( !read_response( bytes_in, size_in ) || size_in == 0 ) {
+			return false;
+		}
+		if( ( bytes_in[0] & 0x3F ) != 0x00 ) {
+			return ( bytes_in[0] & 0x3F ) == status_released;
+		}
+		
+		const emulation_response * answer = nullptr;
+		for( size_t i = 0; i < size_table && answer == nullptr; i++ ) {
+			
+			const emulation_response & entry = table[i];
+			if( ( entry.file != 0 && entry.file != file ) || size_in - 1 < entry.size_command ) {
+				continue;
+			}
+			bool match = true;
+			for( size_t j = 0; j < entry.size_command && match; j++ ) {
+				
+				match = bytes_in[ j + 1 ] == entry.command[j];
+				
+			}
+			if( match ) {
+				answer = &entry;
+			}
+			
+		}
+		
+		if( answer == nullptr ) {
+			write( frame_sw_not_found, sizeof( frame_sw_not_found ) );
+		}
+		else {
+			if( answer->select != 0 ) {
+				file = answer->select;
+			}
+			write( answer->frame, answer->size_frame );
+		}
+		size_t size_ack = 1;
+		read_response( bytes_in, size_ack );
+		
+	}
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an NDEF type 4 tag response table.
+/// \details
+/// This constructor builds every answer a reader needs to read the NDEF
+/// message ndef_message[] from an emulated NFC Forum type 4 tag, so
+/// pn532::emulate_target() never has to build one. The answers to SELECT
+/// and to reading the capability container are constant and point to
+/// frames in flash, the answers to reading the NDEF file (its length and
+/// the message in parts of NDEF_TAG_CHUNK bytes.) are built here once.
+/// Messages longer than NDEF_TAG_MESSAGE_MAX bytes are cut off.
+
+ndef_type4_tag::ndef_type4_tag( const uint8_t ndef_message[], const size_t & size_message ):
+	entries(),
+	size_entries( 0 ),
+	commands(),
+	frames()
+	{
+		const size_t size_file = 2 + ( size_message < NDEF_TAG_MESSAGE_MAX ? size_message : NDEF_TAG_MESSAGE_MAX );
+		
+		entries[ size_entries++ ] = {0, apdu_select_ndef_app, sizeof( apdu_select_ndef_app ), frame_sw_ok, sizeof( frame_sw_ok ), 0};
+		entries[ size_entries++ ] = {0, apdu_select_cc, sizeof( apdu_select_cc ), frame_sw_ok, sizeof( frame_sw_ok ), 0xE103};
+		entries[ size_entries++ ] = {0xE103, apdu_read_cc, sizeof( apdu_read_cc ), frame_cc, sizeof( frame_cc ), 0};
+		entries[ size_entries++ ] = {0, apdu_select_ndef, sizeof( apdu_select_ndef ), frame_sw_ok, sizeof( frame_sw_ok ), 0xE104};
+		
+		// NDEF file: 2 byte length (NLEN.) followed by the message. Readers read NLEN
+		// first and then the message in parts of at most MLe bytes from offset 2.
+		uint8_t file[ NDEF_TAG_MESSAGE_MAX + 2 ] = {(uint8_t)( ( size_file - 2 ) >> 8 ), (uint8_t)( size_file - 2 )};
+		for( size_t i = 2; i < size_file; i++ ) {
+			
+			file[i] = ndef_message[ i - 2 ];
+			
+		}
+		
+		size_t size_commands = 0;
+		size_t size_frames = 0;
+		size_t offset = 0;
+		size_t size_part = 2;
+		while( offset < size_file ) {
+			
+			uint8_t * command = &commands[ size_commands ];
+			command[0] = 0x00;
+			command[1] = 0xB0;
+			command[2] = offset >> 8;
+			command[3] = offset;
+			command[4] = size_part;
+			size_commands += 5;
+			
+			uint8_t answer[ NDEF_TAG_CHUNK + 3 ] = {CC_tg_set_data};
+			for( size_t i = 0; i < size_part; i++ ) {
+				
+				answer[ i + 1 ] = file[ offset + i ];
+				
+			}
+			answer[ size_part + 1 ] = 0x90;
+			answer[ size_part + 2 ] = 0x00;
+			uint8_t * frame = &frames[ size_frames ];
+			const size_t size_frame = pn532::build_frame( answer, size_part + 3, frame );
+			size_frames += size_frame;
+			
+			entries[ size_entries++ ] = {0xE104, command, 5, frame, (uint16_t) size_frame, 0};
+			
+			offset += size_part;
+			size_part = size_file - offset < NDEF_TAG_CHUNK ? size_file - offset : NDEF_TAG_CHUNK;
+			
+		}
+	}
+
+/// \brief
+/// Function returning the response table, to be passed to pn532::emulate_target().
+
+const emulation_response * ndef_type4_tag::table() const {
+
+	return entries.data();
+}
+
+/// \brief
+/// Function returning the amount of entries in table().
+
+size_t ndef_type4_tag::size() const {
+
+	return size_entries;
+}
+
+/// \brief
+/// Function to start a peer to peer link as initiator.
+/// \details
+/// This function activates another NFCIP-1 device, for example a second
+/// PN532 waiting in init_as_dep_target(), with InJumpForDEP at 106, 212 or
+/// 424 kbps, in active mode unless active is false. The device becomes the
+/// active target, afterwards data_exchange() sends data to it and receives
+/// its answer, chaining frames with the MI bit for anything longer than a
+/// single frame. Returns false when no device answered.
+
+bool pn532::dep_initiate( const uint8_t bit_rate, const bool active ) {
+
+	// ActPass, BR, Next (bit 1: passive initiator data follows.), passive initiator data.
+	uint8_t command[9] = {CC_in_jump_for_dep, (uint8_t) active, bit_rate, 0x00};
+	size_t size_command = 4;
+	if( !active && bit_rate != BR_106 ) {
+		
+		// Passive 212 and 424 kbps start with a FeliCa polling of all system codes.
+		const uint8_t polling[5] = {felica_polling, 0xFF, 0xFF, 0x00, 0x00};
+		command[3] = 0x01;
+		for( size_t i = 0; i < 5; i++ ) {
+			
+			command[ size_command++ ] = polling[i];
+			
+		}
+	}
+	write_command( command, size_command );
+	
+	// Status, Tg, NFCID3t, DIDt, BSt, BRt, TO, PPt, general bytes.
+	uint8_t response[ 64 ];
+	size_t size_response = sizeof( response );
+	read_response( response, size_response );
+	
+	target_active = pn532_target();
+	target_selected = false;
+	raw_settings_known = false;
+	if( size_response < 12 || ( response[0] & 0x3F ) != 0x00 ) {
+		return false;
+	}
+	
+	target_active.tg = response[1];
+	target_active.uid_size = 10;
+	for( size_t i = 0; i < 10; i++ ) {
+		
+		target_active.uid[i] = response[ i + 2 ];
+		
+	}
+	target_active.bit_rate = bit_rate;
+	target_selected = true;
+	return true;
+}
+
+/// \brief
+/// Function to let the PN532 act as a peer to peer target.
+/// \details
+/// This function waits with TgInitAsTarget until an NFCIP-1 initiator, for
+/// example a second PN532 calling dep_initiate(), activates the PN532 for
+/// data exchange at any bit rate, in active or passive mode. nfcid3 is sent
+/// in the ATR_RES, its first bytes also make up the NFCID1 and NFCID2
+/// used during passive activation. Afterwards use dep_receive() and
+/// dep_send(). Returns false when the PN532 was not activated for DEP.
+
+bool pn532::init_as_dep_target( const std::array<uint8_t, 10> & nfcid3 ) {
+
+	pn532_parameters parameters = parameters_active;
+	parameters.automatic_atr_res = true;
+	set_parameters( parameters );
+	uint8_t response[ 64 ];
+	
+	// Mode (DEP only.), SENS_RES, NFCID1, SEL_RES (DEP.), FeliCa NFCID2 (01 FE for
+	// DEP.), PAD and system code, NFCID3, no general and historical bytes.
+	uint8_t command[38] = {CC_tg_init_as_target, 0x02, 0x04, 0x00, nfcid3[0], nfcid3[1], nfcid3[2], 0x40,
+						   0x01, 0xFE, nfcid3[0], nfcid3[1], nfcid3[2], nfcid3[3], nfcid3[4], nfcid3[5]};
+	command[24] = 0xFF;
+	command[25] = 0xFF;
+	for( size_t i = 0; i < 10; i++ ) {
+		
+		command[ i + 26 ] = nfcid3[i];
+		
+	}
+	write_command( command, 38 );
+	
+	// Mode the PN532 was activated in (bit 3 is DEP.), followed by the ATR_REQ of the initiator.
+	size_t size_response = sizeof( response );
+	return read_response( response, size_response ) && size_response >= 1 && ( response[0] & 0x04 );
+}
+
+/// \brief
+/// Function to receive data from the initiator while acting as peer to peer target.
+/// \details
+/// This function receives the data sent by the initiator with TgGetData
+/// into data[]. size_data holds the size of data[] when calling and the
+/// amount of bytes received after. As long as the PN532 reports the MI bit
+/// the next part is fetched, so data sent in several chained frames ends up
+/// in data[] in one piece. Data that does not fit is dropped and
+/// status_overflow is returned, otherwise the status byte of the PN532.
+
+uint8_t pn532::dep_receive( uint8_t data[], size_t & size_data ) {
+
+	uint8_t bytes_in[ EXCHANGE_DATA_MAX + 1 ];
+	const uint8_t command[1] = {CC_tg_get_data};
+	size_t received = 0;
+	bool overflow = false;
+	
+	while( true ) {
+		
+		write_command( command, 1 );
+		size_t size_in = exchange_room( size_data, received );
+		if( !read_response( bytes_in, size_in ) || size_in == 0 ) {
+			size_data = received;
+			return status_no_frame;
+		}
+		if( ( bytes_in[0] & 0x3F ) != 0x00 ) {
+			size_data = received;
+			return bytes_in[0] & 0x3F;
+		}
+		
+		for( size_t i = 1; i < size_in && i <= EXCHANGE_DATA_MAX; i++ ) {
+			
+			if( received < size_data ) {
+				data[ received++ ] = bytes_in[i];
+			}
+			else {
+				overflow = true;
+			}
+			
+		}
+		if( !( bytes_in[0] & MI_bit ) ) {
+			break;
+		}
+		
+	}
+	
+	size_data = received;
+	return overflow ? status_overflow : 0x00;
+}
+
+/// \brief
+/// Function to answer the initiator while acting as peer to peer target.
+/// \details
+/// This function sends data[] to the initiator. Data longer than a single
+/// frame is chained: all but the last part are sent with TgSetMetaData,
+/// which sets the MI bit, the last part with TgSetData. The status byte of
+/// the PN532 is returned, 0x00 means success.
+
+uint8_t pn532::dep_send( const uint8_t data[], const size_t & size_data ) {
+
+	uint8_t bytes_out[ EXCHANGE_DATA_MAX + 1 ];
+	uint8_t response[1];
+	size_t sent = 0;
+	
+	do {
+		
+		const size_t size_part = size_data - sent < EXCHANGE_DATA_MAX ? size_data - sent : EXCHANGE_DATA_MAX;
+		bytes_out[0] = sent + size_part < size_data ? CC_tg_set_meta_data : CC_tg_set_data;
+		for( size_t i = 0; i < size_part; i++ ) {
+			
+			bytes_out[ i + 1 ] = data[ sent + i ];
+			
+		}
+		sent += size_part;
+		
+		size_t size_response = 1;
+		write_command( bytes_out, size_part + 1 );
+		if( !read_response( response, size_response ) || size_response != 1 ) {
+			return status_no_frame;
+		}
+		if( ( response[0] & 0x3F ) != 0x00 ) {
+			return response[0] & 0x3F;
+		}
+		
+	} while( sent < size_data );
+	
+	return 0x00;
+}
+
+/// \brief
+/// Function to read registers with a single ReadRegister frame.
+/// \details
+/// This function reads the count registers in addresses[] and places their
+/// values in values[], in the same order. The shadow cache is not used.
+
+bool pn532::read_register_frame( const uint16_t addresses[], uint8_t values[], const size_t & count ) {
+
+	if( count == 0 || count > REGISTERS_MAX ) {
+		return false;
+	}
+	
+	uint8_t command[ 1 + 2 * REGISTERS_MAX ] = {CC_read_register};
+	for( size_t i = 0; i < count; i++ ) {
+		
+		command[ 1 + 2 * i ] = addresses[i] >> 8;
+		command[ 2 + 2 * i ] = addresses[i];
+		
+	}
+	write_command( command, 1 + 2 * count );
+	
+	size_t size_values = count;
+	return read_response( values, size_values ) && size_values == count;
+}
+
+/// \brief
+/// Function to write registers with a single WriteRegister frame.
+/// \details
+/// This function writes values[] to the count registers in addresses[].
+/// The shadow cache is not used.
+
+bool pn532::write_register_frame( const uint16_t addresses[], const uint8_t values[], const size_t & count ) {
+
+	if( count == 0 || count > REGISTERS_MAX ) {
+		return false;
+	}
+	
+	uint8_t command[ 1 + 3 * REGISTERS_MAX ] = {CC_write_register};
+	for( size_t i = 0; i < count; i++ ) {
+		
+		command[ 1 + 3 * i ] = addresses[i] >> 8;
+		command[ 2 + 3 * i ] = addresses[i];
+		command[ 3 + 3 * i ] = values[i];
+		
+	}
+	write_command( command, 1 + 3 * count );
+	
+	uint8_t response[1];
+	size_t size_response = 1;
+	return read_response( response, size_response ) && size_response == 0;
+}
+
+/// \brief
+/// Function to find the shadow copy of a register.
+/// \details
+/// Returns nullptr when the register is not shadowed, see shadow_register().
+
+pn532::register_shadow * pn532::find_shadow( const uint16_t address ) {
+
+	for( size_t i = 0; i < shadow_size; i++ ) {
+		
+		if( shadow[i].address == address ) {
+			return &shadow[i];
+		}
+		
+	}
+	return nullptr;
+}
+
+/// \brief
+/// Function to read several registers of the PN532 at once.
+/// \details
+/// This function places the values of the count registers in addresses[]
+/// in values[], in the same order. Shadowed registers (see
+/// shadow_register().) with a known value are answered from the shadow
+/// cache, all others are read with a single ReadRegister frame, so a whole
+/// set of registers costs at most one exchange. At most REGISTERS_MAX
+/// registers can be read at once.
+
+bool pn532::read_registers( const uint16_t addresses[], uint8_t values[], const size_t & count ) {
+
+	if( count == 0 || count > REGISTERS_MAX ) {
+		return false;
+	}
+	
+	uint16_t uncached_addresses[ REGISTERS_MAX ];
+	uint8_t uncached_index[ REGISTERS_MAX ];
+	size_t uncached = 0;
+	for( size_t i = 0; i < count; i++ ) {
+		
+		const register_shadow * copy = find_shadow( addresses[i] );
+		if( copy != nullptr && copy->known ) {
+			values[i] = copy->value;
+		}
+		else {
+			uncached_addresses[ uncached ] = addresses[i];
+			uncached_index[ uncached++ ] = i;
+		}
+		
+	}
+	if( uncached == 0 ) {
+		return true;
+	}
+	
+	uint8_t uncached_values[ REGISTERS_MAX ];
+	if( !read_register_frame( uncached_addresses, uncached_values, uncached ) ) {
+		return false;
+	}
+	for( size_t i = 0; i < uncached; i++ ) {
+		
+		values[ uncached_index[i] ] = uncached_values[i];
+		register_shadow * copy = find_shadow( uncached_addresses[i] );
+		if( copy != nullptr ) {
+			copy->value = uncached_values[i];
+			copy->known = true;
+		}
+		
+	}
+	return true;
+}
+
+/// \brief
+/// Function to write several registers of the PN532 at once.
+/// \details
+/// This function writes values[] to the count registers in addresses[]
+/// with a single WriteRegister frame. Shadowed registers that are known to
+/// hold their value already are left out, when nothing is left no frame is
+/// sent at all. At most REGISTERS_MAX registers can be written at once.
+
+bool pn532::write_registers( const uint16_t addresses[], const uint8_t values[], const size_t & count ) {
+
+	if( count == 0 || count > REGISTERS_MAX ) {
+		return false;
+	}
+	
+	uint16_t changed_addresses[ REGISTERS_MAX ];
+	uint8_t changed_values[ REGISTERS_MAX ];
+	size_t changed = 0;
+	for( size_t i = 0; i < count; i++ ) {
+		
+		const register_shadow * copy = find_shadow( addresses[i] );
+		if( copy == nullptr || !copy->known || copy->value != values[i] ) {
+			changed_addresses[ changed ] = addresses[i];
+			changed_values[ changed++ ] = values[i];
+		}
+		
+	}
+	if( changed == 0 ) {
+		return true;
+	}
+	
+	const bool written = write_register_frame( changed_addresses, changed_values, changed );
+	for( size_t i = 0; i < changed; i++ ) {
+		
+		register_shadow * copy = find_shadow( changed_addresses[i] );
+		if( copy != nullptr ) {
+			copy->value = changed_values[i];
+			copy->known = written;
+		}
+		
+	}
+	return written;
+}
+
+/// \brief
+/// Function to keep a shadow copy of a register.
+/// \details
+/// Once its value is known, by reading or writing it, a shadowed register
+/// is never read from the PN532 again and only written when its value
+/// changes. Only shadow registers that nothing but the host modifies, such
+/// as RF tuning registers: the firmware of the PN532 changes registers like
+/// CIU_TxMode itself during activation, which would make their copies
+/// wrong. At most SHADOW_MAX registers can be shadowed.
+
+bool pn532::shadow_register( const uint16_t address ) {
+
+	if( find_shadow( address ) != nullptr ) {
+		return true;
+	}
+	if( shadow_size >= SHADOW_MAX ) {
+		return false;
+	}
+	shadow[ shadow_size++ ] = {address, 0x00, false};
+	return true;
+}
+
+/// \brief
+/// Function to forget the values of all shadowed registers.
+/// \details
+/// Call this when the registers may have changed behind the library's
+/// back, the next read or write of each of them goes to the PN532 again.
+
+void pn532::invalidate_shadow() {
+
+	for( size_t i = 0; i < shadow_size; i++ ) {
+		
+		shadow[i].known = false;
+		
+	}
+}
+
+/// \brief
+/// Function to set or clear bits in several registers.
+/// \details
+/// The current values are read with one frame and the changed values
+/// written with another, registers that already hold the wanted bits are
+/// left alone.
+
+bool pn532::set_register_bits( const uint16_t addresses[], const uint8_t bits[], const bool set, const size_t & count ) {
+
+	uint8_t values[ REGISTERS_MAX ];
+	if( !read_registers( addresses, values, count ) ) {
+		return false;
+	}
+	
+	uint16_t changed_addresses[ REGISTERS_MAX ];
+	uint8_t changed_values[ REGISTERS_MAX ];
+	size_t changed = 0;
+	for( size_t i = 0; i < count; i++ ) {
+		
+		const uint8_t value = set ? values[i] | bits[i] : values[i] & ~bits[i];
+		if( value != values[i] ) {
+			changed_addresses[ changed ] = addresses[i];
+			changed_values[ changed++ ] = value;
+		}
+		
+	}
+	return changed == 0 || write_registers( changed_addresses, changed_values, changed );
+}
+
+/// \brief
+/// Function to let the PN532 add and check CRC's on raw data.
+/// \details
+/// When enabled, the CIU of the PN532 appends the ISO14443A CRC to everything
+/// sent with communicate_thru() and checks and strips it from the answer,
+/// so the host never has to compute one. Proprietary commands that carry
+/// their own CRC, or none, need it disabled. The setting is remembered, the
+/// registers are only written when it changes.
+
+bool pn532::set_crc( const bool enable ) {
+
+	if( raw_settings_known && raw_crc == enable ) {
+		return true;
+	}
+	
+	const uint16_t addresses[2] = {CIU_TxMode, CIU_RxMode};
+	const uint8_t bits[2] = {CIU_CRC_enable, CIU_CRC_enable};
+	if( !set_register_bits( addresses, bits, enable, 2 ) ) {
+		raw_settings_known = false;
+		return false;
+	}
+	
+	// The parity setting is only known when it was written since the last activation.
+	if( !raw_settings_known ) {
+		const uint16_t parity_address[1] = {CIU_ManualRCV};
+		uint8_t value[1];
+		if( !read_registers( parity_address, value, 1 ) ) {
+			return false;
+		}
+		raw_parity = !( value[0] & CIU_parity_disable );
+	}
+	raw_crc = enable;
+	raw_settings_known = true;
+	return true;
+}
+
+/// \brief
+/// Function to let the PN532 add and check parity bits on raw data.
+/// \details
+/// Enabled is the ISO14443A default, some proprietary cards need it disabled.
+/// The setting is remembered, the register is only written when it changes.
+
+bool pn532::set_parity( const bool enable ) {
+
+	if( raw_settings_known && raw_parity == enable ) {
+		return true;
+	}
+	
+	const uint16_t addresses[3] = {CIU_ManualRCV, CIU_TxMode, CIU_RxMode};
+	uint8_t values[3];
+	if( !read_registers( addresses, values, raw_settings_known ? 1 : 3 ) ) {
+		raw_settings_known = false;
+		return false;
+	}
+	
+	const uint8_t value = enable ? values[0] & ~CIU_parity_disable : values[0] | CIU_parity_disable;
+	if( value != values[0] && !write_registers( addresses, &value, 1 ) ) {
+		raw_settings_known = false;
+		return false;
+	}
+	
+	if( !raw_settings_known ) {
+		raw_crc = ( values[1] & CIU_CRC_enable ) && ( values[2] & CIU_CRC_enable );
+	}
+	raw_parity = enable;
+	raw_settings_known = true;
+	return true;
+}
+
+/// \brief
+/// Function to send raw data to the active card.
+/// \details
+/// This function sends data[] to the card with InCommunicateThru, the PN532
+/// adds nothing but the CRC and parity settings chosen with set_crc() and
+/// set_parity(), and places the answer of the card in response[].
+/// size_response holds the size of response[] when calling and the amount
+/// of bytes received after. The status byte of the PN532 is returned,
+/// 0x00 means success.
+
+uint8_t pn532::communicate_thru( const uint8_t data[], const size_t & size_data, uint8_t response[], size_t & size_response ) {
+
+	if( size_data > EXCHANGE_DATA_MAX ) {
+		size_response = 0;
+		return status_overflow;
+	}
+	
+	uint8_t bytes_out[ EXCHANGE_DATA_MAX + 1 ] = {CC_in_communicate_thru};
+	for( size_t i = 0; i < size_data; i++ ) {
+		
+		bytes_out[ i + 1 ] = data[i];
+		
+	}
+	write_command( bytes_out, size_data + 1 );
+	
+	uint8_t bytes_in[ EXCHANGE_DATA_MAX + 1 ];
+	size_t size_in = exchange_room( size_response, 0 );
+	if( !read_response( bytes_in, size_in ) || size_in == 0 ) {
+		size_response = 0;
+		return status_no_frame;
+	}
+	
+	size_in -= 1;
+	if( size_in < size_response ) {
+		size_response = size_in;
+	}
+	for( size_t i = 0; i < size_response; i++ ) {
+		
+		response[i] = bytes_in[ i + 1 ];
+		
+	}
+	return bytes_in[0] & 0x3F;
+}
+
+/// \brief
+/// Function to choose which protocol steps the PN532 takes care of itself.
+/// \details
+/// This function sends the flags of parameters to the PN532 with
+/// SetParameters, see pn532_parameters. With automatic RATS an ISO14443-4
+/// card is fully activated by the single InListPassiveTarget exchange,
+/// without it the host has to send RATS itself. The parameters are
+/// remembered, sending the same parameters again costs no exchange.
+
+bool pn532::set_parameters( const pn532_parameters & parameters ) {
+
+	if( parameters_known &&
+		parameters.nad_used == parameters_active.nad_used &&
+		parameters.did_used == parameters_active.did_used &&
+		parameters.automatic_atr_res == parameters_active.automatic_atr_res &&
+		parameters.automatic_rats == parameters_active.automatic_rats &&
+		parameters.iso14443_4_picc == parameters_active.iso14443_4_picc ) {
+		return true;
+	}
+	
+	const uint8_t flags = ( parameters.nad_used ? param_nad_used : 0 ) |
+						  ( parameters.did_used ? param_did_used : 0 ) |
+						  ( parameters.automatic_atr_res ? param_automatic_atr_res : 0 ) |
+						  ( parameters.automatic_rats ? param_automatic_rats : 0 ) |
+						  ( parameters.iso14443_4_picc ? param_iso14443_4_picc : 0 );
+	const uint8_t command[2] = {CC_set_parameters, flags};
+	uint8_t response[1];
+	write_command( command, 2 );
+	
+	// SetParameters answers with an empty frame, anything else means it failed.
+	size_t size_response = 1;
+	parameters_known = read_response( response, size_response ) && size_response == 0;
+	parameters_active = parameters;
+	return parameters_known;
+}
+
+/// \brief
+/// Function returning the amount of frames written to the PN532.
+/// \details
+/// Every command costs one exchange, retries after a missing ack are not
+/// counted. Reset the count before and read it after an operation to see
+/// what that operation costs on the bus, for example a card activation
+/// with and without automatic RATS, see set_parameters().
+
+uint32_t pn532::exchange_count() const {
+
+	return exchanges;
+}
+
+/// \brief
+/// Function to set the exchange count back to 0.
+
+void pn532::reset_exchange_count() {
+
+	exchanges = 0;
+
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an NDEF parser.
+/// \details
+/// image[] is the data area of the card, it must stay alive as long as the
+/// views returned by the parser are used.
+
+ndef_parser::ndef_parser( const uint8_t image[], const size_t & size_image ):
+	image( image ),
+	size_image( size_image ),
+	offset_tlv( 0 ),
+	message( nullptr ),
+	size_message( 0 ),
+	offset_record( 0 )
+	{}
+
+/// \brief
+/// Function to move to the next NDEF message.
+/// \details
+/// This function skips TLV's until the next NDEF message TLV, which the
+/// records returned by next_record() are read from afterwards. Returns false
+/// at the terminator TLV, the end of the image or a TLV that does not fit.
+
+bool ndef_parser::next_message() {
+
+	message = nullptr;
+	size_message = 0;
+	offset_record = 0;
+	
+	while( offset_tlv < size_image ) {
+		
+		const uint8_t type = image[ offset_tlv++ ];
+		if( type == tlv_null ) {
+			continue;
+		}
+		if( type == tlv_terminator || offset_tlv >= size_image ) {
+			return false;
+		}
+		
+		// Lengths up to 254 take 1 byte, longer ones 0xFF followed by 2 bytes.
+		size_t length = image[ offset_tlv++ ];
+		if( length == 0xFF ) {
+			if( offset_tlv + 2 > size_image ) {
+				return false;
+			}
+			length = ( image[ offset_tlv ] << 8 ) | image[ offset_tlv + 1 ];
+			offset_tlv += 2;
+		}
+		if( offset_tlv + length > size_image ) {
+			return false;
+		}
+		
+		const size_t value = offset_tlv;
+		offset_tlv += length;
+		if( type == tlv_ndef ) {
+			message = image + value;
+			size_message = length;
+			return true;
+		}
+		
+	}
+	return false;
+}
+
+/// \brief
+/// Function to read the next record of the current NDEF message.
+/// \details
+/// Call next_message() first. The record's type, ID and payload point into
+/// the image. Returns false after the last record or when a record does not
+/// fit in its message. Chunked records are returned chunk by chunk.
+
+bool ndef_parser::next_record( ndef_record & record ) {
+
+	if( message == nullptr || offset_record >= size_message ) {
+		return false;
+	}
+	
+	// Header, type length, payload length (1 or 4 bytes.), ID length, type, ID, payload.
+	size_t offset = offset_record;
+	record = ndef_record();
+	record.header = message[ offset++ ];
+	record.tnf = record.header & ndef_tnf;
+	
+	const size_t size_lengths = 1 + ( record.header & ndef_sr ? 1 : 4 ) + ( record.header & ndef_il ? 1 : 0 );
+	if( offset + size_lengths > size_message ) {
+		return false;
+	}
+	record.size_type = message[ offset++ ];
+	if( record.header & ndef_sr ) {
+		record.size_payload = message[ offset++ ];
+	}
+	else {
+		record.size_payload = ( uint32_t( message[ offset ] ) << 24 ) | ( uint32_t( message[ offset + 1 ] ) << 16 ) |
+							  ( uint32_t( message[ offset + 2 ] ) << 8 ) | message[ offset + 3 ];
+		offset += 4;
+	}
+	if( record.header & ndef_il ) {
+		record.size_id = message[ offset++ ];
+	}
+	
+	if( offset + record.size_type + record.size_id > size_message ||
+		record.size_payload > size_message - offset - record.size_type - record.size_id ) {
+		return false;
+	}
+	record.type = message + offset;
+	offset += record.size_type;
+	record.id = message + offset;
+	offset += record.size_id;
+	record.payload = message + offset;
+	offset += record.size_payload;
+	
+	offset_record = record.header & ndef_me ? size_message : offset;
+	return true;
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an NDEF writer.
+/// \details
+/// The message is written to image[] from its start on, size_block is the
+/// block (or page.) size the finished image is padded to.
+
+ndef_writer::ndef_writer( uint8_t image[], const size_t & size_image, const size_t & size_block ):
+	image( image ),
+	size_image( size_image ),
+	size_block( size_block == 0 ? 1 : size_block ),
+	offset_message( 2 ),
+	size_message( 0 ),
+	offset_last_header( 0 ),
+	failed( size_image < 3 )
+	{}
+
+/// \brief
+/// Function to add a record to the message.
+/// \details
+/// The record is written directly behind the previous one, as a short
+/// record when its payload is shorter than 256 bytes. The message begin and
+/// end flags are taken care of. Returns false, and leaves the image as it
+/// was, when the record does not fit. The writer is failed from then on,
+/// so finish() returns 0 instead of a message that misses the record.
+
+bool ndef_writer::add_record( const uint8_t tnf, const uint8_t type[], const uint8_t & size_type, const uint8_t payload[], const size_t & size_payload ) {
+
+	const bool short_record = size_payload < 0x100;
+	const size_t size_record = 2 + ( short_record ? 1 : 4 ) + size_type + size_payload;
+	
+	// Room is kept for a 3 byte TLV length and the terminator TLV.
+	if( failed || offset_message + size_message + size_record + 3 > size_image ) {
+		failed = true;
+		return false;
+	}
+	
+	size_t offset = offset_message + size_message;
+	const size_t header = offset;
+	image[ offset++ ] = ( size_message == 0 ? ndef_mb : 0 ) | ( short_record ? ndef_sr : 0 ) | ( tnf & ndef_tnf );
+	image[ offset++ ] = size_type;
+	if( short_record ) {
+		image[ offset++ ] = size_payload;
+	}
+	else {
+		image[ offset++ ] = size_payload >> 24;
+		image[ offset++ ] = size_payload >> 16;
+		image[ offset++ ] = size_payload >> 8;
+		image[ offset++ ] = size_payload;
+	}
+	for( size_t i = 0; i < size_type; i++ ) {
+		
+		image[ offset++ ] = type[i];
+		
+	}
+	for( size_t i = 0; i < size_payload; i++ ) {
+		
+		image[ offset++ ] = payload[i];
+		
+	}
+	
+	offset_last_header = header;
+	size_message += size_record;
+	return true;
+}
+
+/// \brief
+/// Function to close the message.
+/// \details
+/// This function sets the message end flag of the last record, fills in
+/// the TLV length, adds the terminator TLV and pads the image with zeros
+/// (NULL TLV's.) up to a whole amount of blocks. Messages of 255 bytes or
+/// more need a 3 byte TLV length, they are moved up 2 bytes once here.
+/// The amount of image bytes to write to the card is returned, 0 when a
+/// record did not fit or nothing was added.
+
+size_t ndef_writer::finish() {
+
+	if( failed || size_message == 0 ) {
+		return 0;
+	}
+	image[ offset_last_header ] |= ndef_me;
+	
+	if( size_message >= 0xFF ) {
+		
+		for( size_t i = size_message; i > 0; i-- ) {
+			
+			image[ offset_message + 1 + i ] = image[ offset_message + i - 1 ];
+			
+		}
+		image[1] = 0xFF;
+		image[2] = size_message >> 8;
+		image[3] = size_message;
+		offset_message += 2;
+		
+	}
+	else {
+		
+		image[1] = size_message;
+		
+	}
+	image[0] = tlv_ndef;
+	
+	size_t size_used = offset_message + size_message;
+	image[ size_used++ ] = tlv_terminator;
+	while( size_used % size_block != 0 && size_used < size_image ) {
+		
+		image[ size_used++ ] = tlv_null;
+		
+	}
+	
+	// The message can not be added to after this.
+	failed = true;
+	return size_used;
+}
+
+/// \brief
+/// Function to set how often the PN532 tries to activate a card.
+/// \details
+/// After a reset the PN532 keeps trying forever, which makes list_target()
+/// and get_card_uid() wait until a card arrives. With a finite amount of
+/// retries list_target() returns false when no card answered. 0xFF means
+/// forever again. The setting is remembered, it is only sent when it changes.
+
+bool pn532::set_passive_retries( const uint8_t retries ) {
+
+	if( retries == passive_retries ) {
+		return true;
+	}
+	
+	// MxRtyATR and MxRtyPSL keep their defaults.
+	const uint8_t command[5] = {CC_rf_configuration, rf_max_retries, 0xFF, 0x01, retries};
+	uint8_t response[1];
+	size_t size_response = 1;
+	write_command( command, 5 );
+	if( !read_response( response, size_response ) || size_response != 0 ) {
+		return false;
+	}
+	passive_retries = retries;
+	return true;
+}
+
+/// \brief
+/// Function to collect the UID of every type A card in the field.
+/// \details
+/// Stacked badges or an inventory tray hold several cards at once, while
+/// list_target() only returns one. This function keeps activating a card
+/// and releasing it again, which halts it so it stays silent for the next
+/// activation, and adds each UID to found. It stops as soon as no card
+/// answers within retries activation attempts or a UID shows up that
+/// found already holds (or found is full.), so an empty field costs a single
+/// InListPassiveTarget.
+/// The activation retries set before (see set_passive_retries().) are set
+/// back afterwards. Returns the amount of UID's added to found.
+
+size_t pn532::enumerate_targets( uid_set & found, const uint8_t retries ) {
+
+	const uint8_t retries_before = passive_retries;
+	set_passive_retries( retries );
+	
+	size_t added = 0;
+	pn532_target target;
+	while( list_target( target ) ) {
+		
+		release_target();
+		if( !found.insert( card_uid( target ) ) ) {
+			break;
+		}
+		added += 1;
+		
+	}
+	
+	set_passive_retries( retries_before );
+	return added;
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an empty card UID, its size is 0.
+
+card_uid::card_uid():
+	bytes(),
+	size_bytes( 0 ),
+	sens_res_card( 0 ),
+	sel_res_card( 0 ),
+	packed( 0 )
+	{}
+
+/// \brief
+/// Constructor of a card UID from size_uid bytes, at most 10 are used.
+
+card_uid::card_uid( const uint8_t uid[], const size_t & size_uid, const uint16_t sens_res, const uint8_t sel_res ):
+	bytes(),
+	size_bytes( size_uid < 10 ? size_uid : 10 ),
+	sens_res_card( sens_res ),
+	sel_res_card( sel_res ),
+	packed( 0 )
+{
+	for( size_t i = 0; i < size_bytes; i++ ) {
+		
+		bytes[i] = uid[i];
+		
+	}
+	pack();
+}
+
+/// \brief
+/// Constructor of a card UID from a card found with pn532::list_target() or pn532::read_card().
+
+card_uid::card_uid( const pn532_target & target ):
+	card_uid( target.uid.data(), target.uid_size, target.sens_res, target.sel_res )
+	{}
+
+/// \brief
+/// Function to calculate key().
+/// \details
+/// 4 and 7 byte UID's: the length in the highest byte and the UID bytes
+/// below it, first byte highest. Other lengths: the length in the highest
+/// byte and a FNV-1a hash of the bytes below it.
+
+void card_uid::pack() {
+
+	uint64_t value = 0;
+	if( packable() ) {
+		
+		for( size_t i = 0; i < size_bytes; i++ ) {
+			
+			value |= uint64_t( bytes[i] ) << ( 8 * ( 6 - i ) );
+			
+		}
+		
+	}
+	else {
+		
+		value = 0xCBF29CE484222325;
+		for( size_t i = 0; i < size_bytes; i++ ) {
+			
+			value = ( value ^ bytes[i] ) * 0x100000001B3;
+			
+		}
+		
+	}
+	packed = ( uint64_t( size_bytes ) << 56 ) | ( value & 0x00FFFFFFFFFFFFFF );
+
+}
+
+/// \brief
+/// Function returning the bytes of the UID, size() bytes are valid.
+
+const uint8_t * card_uid::data() const {
+
+	return bytes.data();
+}
+
+/// \brief
+/// Function returning the length of the UID, 0 for an empty UID.
+
+size_t card_uid::size() const {
+
+	return size_bytes;
+}
+
+/// \brief
+/// Function returning the SENS_RES (ATQA) the card answered with.
+
+uint16_t card_uid::sens_res() const {
+
+	return sens_res_card;
+}
+
+/// \brief
+/// Function returning the SEL_RES (SAK) the card answered with.
+
+uint8_t card_uid::sel_res() const {
+
+	return sel_res_card;
+}
+
+/// \brief
+/// Function returning whether key() holds the whole UID, true for 4 and 7 byte UID's.
+
+bool card_uid::packable() const {
+
+	return size_bytes == 4 || size_bytes == 7;
+}
+
+/// \brief
+/// Function returning the packed 64 bit form of the UID.
+/// \details
+/// Equal UID's have equal keys. For packable() UID's the reverse holds as
+/// well, so the key can be stored and compared instead of the UID.
+
+uint64_t card_uid::key() const {
+
+	return packed;
+}
+
+/// \brief
+/// Function to compare two UID's, SENS_RES and SEL_RES are not compared.
+
+bool card_uid::operator==( const card_uid & other ) const {
+
+	if( packed != other.packed ) {
+		return false;
+	}
+	if( packable() ) {
+		return true;
+	}
+	for( size_t i = 0; i < size_bytes; i++ ) {
+		
+		if( bytes[i] != other.bytes[i] ) {
+			return false;
+		}
+		
+	}
+	return true;
+}
+
+/// \brief
+/// Function to compare two UID's, see operator==().
+
+bool card_uid::operator!=( const card_uid & other ) const {
+
+	return !( *this == other );
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an empty UID set.
+
+uid_set::uid_set():
+	uids(),
+	count( 0 )
+	{}
+
+/// \brief
+/// Function to check whether the set holds a UID.
+
+bool uid_set::contains( const card_uid & uid ) const {
+
+	for( size_t i = 0; i < count; i++ ) {
+		
+		if( uids[i] == uid ) {
+			return true;
+		}
+		
+	}
+	return false;
+}
+
+/// \brief
+/// Function to check whether the set holds a UID of size_uid bytes.
+
+bool uid_set::contains( const uint8_t uid[], const size_t & size_uid ) const {
+
+	return size_uid <= 10 && contains( card_uid( uid, size_uid ) );
+}
+
+/// \brief
+/// Function to add a UID to the set.
+/// \details
+/// Returns false when the set already holds the UID or is full.
+
+bool uid_set::insert( const card_uid & uid ) {
+
+	if( count >= UID_SET_MAX || contains( uid ) ) {
+		return false;
+	}
+	uids[ count++ ] = uid;
+	return true;
+}
+
+/// \brief
+/// Function to add a UID of size_uid bytes to the set, see insert().
+
+bool uid_set::insert( const uint8_t uid[], const size_t & size_uid ) {
+
+	return size_uid <= 10 && insert( card_uid( uid, size_uid ) );
+}
+
+/// \brief
+/// Function returning the UID at index, index must be below size().
+
+const card_uid & uid_set::at( const size_t & index ) const {
+
+	return uids[ index ];
+}
+
+/// \brief
+/// Function returning the amount of UID's in the set.
+
+size_t uid_set::size() const {
+
+	return count;
+}
+
+/// \brief
+/// Function returning the bytes of the UID at index, index must be below size().
+
+const uint8_t * uid_set::uid( const size_t & index ) const {
+
+	return uids[ index ].data();
+}
+
+/// \brief
+/// Function returning the length of the UID at index, index must be below size().
+
+size_t uid_set::size_uid( const size_t & index ) const {
+
+	return uids[ index ].size();
+}
+
+/// \brief
+/// Function to empty the set.
+
+void uid_set::clear() {
+
+	count = 0;
+
+}
+
+/// \brief
+/// Function to find the port and bit of a GPIO pin.
+/// \details
+/// pin is the number printed on the board: 30, 31, 33 and 35 on port 3,
+/// 71 and 72 on port 7 (I2C only.) Reserved and unknown pins return false.
+
+bool pn532::gpio_pin_bit( const uint8_t pin, uint8_t * & port, uint8_t & bit ) {
+
+	if( pin >= 30 && pin <= 35 && pin != 32 && pin != 34 ) {
+		port = &gpio_pending_p3;
+		bit = 1 << ( pin - 30 );
+		return true;
+	}
+	if( ( pin == 71 || pin == 72 ) && using_i2c ) {
+		port = &gpio_pending_p7;
+		bit = 1 << ( pin - 70 );
+		return true;
+	}
+	return false;
+}
+
+/// \brief
+/// Function to make a GPIO pin HIGH.
+/// \details
+/// The change is only remembered, flush_gpio() sends all changes made since
+/// the last flush in a single WriteGPIO frame. Returns false for pins that
+/// can not be used, see gpio_pin_bit().
+
+bool pn532::set_pin( const uint8_t pin ) {
+
+	uint8_t * port;
+	uint8_t bit;
+	if( !gpio_pin_bit( pin, port, bit ) ) {
+		return false;
+	}
+	*port |= bit;
+	return true;
+}
+
+/// \brief
+/// Function to make a GPIO pin LOW.
+/// \details
+/// See set_pin().
 
-}
\ No newline at end of file
+bool pn532::clear_pin( const uint8_t pin ) {
+
+	uint8_t * port;
+	uint8_t bit;
+	if( !gpio_pin_bit( pin, port, bit ) ) {
+		return false;
+	}
+	*port &= ~bit;
+	return true;
+}
+
+/// \brief
+/// Function to flip a GPIO pin.
+/// \details
+/// See set_pin(), flipping a pin twice before a flush sends nothing.
+
+bool pn532::toggle( const uint8_t pin ) {
+
+	uint8_t * port;
+	uint8_t bit;
+	if( !gpio_pin_bit( pin, port, bit ) ) {
+		return false;
+	}
+	*port ^= bit;
+	return true;
+}
+
+/// \brief
+/// Function to send the changes made with set_pin(), clear_pin() and toggle().
+/// \details
+/// All pending changes of both ports go out in one WriteGPIO frame, ports
+/// that end up as they were are left out and when nothing changed nothing
+/// is sent, see write_gpio(). Returns false when the PN532 did not confirm
+/// the write, the changes stay pending in that case.
+
+bool pn532::flush_gpio() {
+
+	return write_gpio( 0x80 | gpio_pending_p3, 0x80 | gpio_pending_p7 );
+}
+
+/// \brief
+/// Function to tell which GPIO pins are used as inputs.
+/// \details
+/// By default read_gpio() answers from the states the library wrote, since
+/// nothing else changes them. Pins driven by something outside the PN532
+/// (a button pulling a HIGH pin low for example.) must be listed here in
+/// the format of read_gpio(), read_gpio() then reads the PN532 again.
+
+void pn532::watch_gpio_inputs( const uint8_t inputs_p3, const uint8_t inputs_p7 ) {
+
+	gpio_input_p3 = inputs_p3 & 0x3F;
+	gpio_input_p7 = inputs_p7 & 0x06;
+
+}
+
+/// \brief
+/// Function returning the multiplexer channel of the PN532, MUX_NO_CHANNEL when there is none.
+
+uint8_t pn532::get_mux_channel() const {
+
+	return mux != nullptr ? mux_channel : MUX_NO_CHANNEL;
+}
+
+/// \brief
+/// Function to switch the multiplexer (if any.) to the channel of this PN532.
+
+void pn532::select_channel() {
+
+	if( mux != nullptr ) {
+		mux->select( mux_channel );
+	}
+
+}
+
+/// \brief
+/// Function returning the bus I2C transfers go over, the bus of the multiplexer when there is one.
+
+hwlib::i2c_bus & pn532::active_bus() {
+
+	return mux != nullptr ? mux->get_bus() : i2c_bus;
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an empty GPIO sequence for the given chip.
+
+gpio_sequence::gpio_sequence( pn532 & chip ):
+	chip( chip ),
+	steps(),
+	size_steps( 0 ),
+	current( 0 ),
+	running( false ),
+	repeat( false ),
+	step_end_us( 0 )
+	{}
+
+/// \brief
+/// Function to add a step to the end of the sequence.
+/// \details
+/// Returns false when the sequence already holds GPIO_SEQUENCE_MAX steps.
+
+bool gpio_sequence::add( const uint8_t gpio_p3, const uint8_t gpio_p7, const uint16_t duration_ms ) {
+
+	if( size_steps >= GPIO_SEQUENCE_MAX ) {
+		return false;
+	}
+	steps[ size_steps++ ] = {gpio_p3, gpio_p7, duration_ms};
+	return true;
+}
+
+/// \brief
+/// Function to remove all steps, a running sequence stops.
+
+void gpio_sequence::clear() {
+
+	size_steps = 0;
+	running = false;
+
+}
+
+/// \brief
+/// Function to start playing the sequence from its first step.
+/// \details
+/// The first step is written right away, when repeat is set the sequence
+/// starts over after its last step until stop() is called.
+
+void gpio_sequence::start( const bool repeat ) {
+
+	if( size_steps == 0 ) {
+		return;
+	}
+	this->repeat = repeat;
+	current = 0;
+	running = true;
+	chip.write_gpio( steps[0].gpio_p3, steps[0].gpio_p7 );
+	step_end_us = hwlib::now_us() + uint_fast64_t( steps[0].duration_ms ) * 1000;
+
+}
+
+/// \brief
+/// Function to stop playing, the GPIO keep their current states.
+
+void gpio_sequence::stop() {
+
+	running = false;
+
+}
+
+/// \brief
+/// Function to play the sequence, call this as often as possible.
+/// \details
+/// Nothing happens until the current step is over, then the next step is
+/// written. Step times are counted from the planned end of the previous
+/// step, so a late call does not make the whole pattern drift. Returns
+/// false when the sequence is not (or no longer.) playing.
+
+bool gpio_sequence::update() {
+
+	if( !running ) {
+		return false;
+	}
+	if( hwlib::now_us() < step_end_us ) {
+		return true;
+	}
+	
+	current += 1;
+	if( current >= size_steps ) {
+		if( !repeat ) {
+			running = false;
+			return false;
+		}
+		current = 0;
+	}
+	
+	chip.write_gpio( steps[ current ].gpio_p3, steps[ current ].gpio_p7 );
+	step_end_us += uint_fast64_t( steps[ current ].duration_ms ) * 1000;
+	return true;
+}
+
+/// \brief
+/// Function returning whether the sequence is playing.
+
+bool gpio_sequence::is_running() const {
+
+	return running;
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of a trace writer, the records go to out.
+
+pn532_trace::pn532_trace( hwlib::ostream & out ):
+	out( out )
+	{}
+
+/// \brief
+/// Function to write a single record, see TRACE_SYNC.
+
+void pn532_trace::record( const uint8_t type, const uint8_t payload[], const size_t & size_payload ) {
+
+	const uint8_t header[2] = { type, uint8_t( size_payload ) };
+	uint8_t crc = crc8( header, 2 );
+	crc = crc8( payload, size_payload, crc );
+	
+	out << char( TRACE_SYNC ) << char( type ) << char( size_payload );
+	for( size_t i = 0; i < size_payload; i++ ) {
+		out << char( payload[i] );
+	}
+	out << char( crc );
+	out.flush();
+
+}
+
+/// \brief
+/// Function to trace the UID of a card.
+/// \details
+/// Use this with the target filled by list_target().
+
+void pn532_trace::uid( const pn532_target & target ) {
+
+	uint8_t payload[13];
+	payload[0] = uint8_t( target.sens_res );
+	payload[1] = uint8_t( target.sens_res >> 8 );
+	payload[2] = target.sel_res;
+	for( size_t i = 0; i < target.uid_size; i++ ) {
+		payload[ 3 + i ] = target.uid[i];
+	}
+	record( trace_uid, payload, 3 + target.uid_size );
+
+}
+
+/// \brief
+/// Function to trace a block read with read_eeprom_block(), status is 0 when it succeeded.
+
+void pn532_trace::block( const uint8_t blocknr, const uint8_t status, const std::array<uint8_t, 16> & data ) {
+
+	uint8_t payload[18];
+	payload[0] = blocknr;
+	payload[1] = status;
+	for( size_t i = 0; i < 16; i++ ) {
+		payload[ 2 + i ] = data[i];
+	}
+	record( trace_block, payload, 18 );
+
+}
+
+/// \brief
+/// Function to trace the time since start and the amount of frames written to chip.
+
+void pn532_trace::stats( const pn532 & chip ) {
+
+	const uint32_t time_ms = uint32_t( hwlib::now_us() / 1000 );
+	const uint32_t frames = chip.exchange_count();
+	uint8_t payload[8];
+	for( size_t i = 0; i < 4; i++ ) {
+		payload[i] = uint8_t( time_ms >> ( 8 * i ) );
+		payload[ 4 + i ] = uint8_t( frames >> ( 8 * i ) );
+	}
+	record( trace_stats, payload, 8 );
+
+}
+
+/// \brief
+/// Function to calculate the CRC-8 of a trace record.
+/// \details
+/// Polynomial 0x07, initial value 0. Pass the result of a previous call as
+/// crc to continue over more data.
+
+uint8_t pn532_trace::crc8( const uint8_t data[], const size_t & size_data, uint8_t crc ) {
+
+	for( size_t i = 0; i < size_data; i++ ) {
+		crc ^= data[i];
+		for( size_t bit = 0; bit < 8; bit++ ) {
+			crc = ( crc & 0x80 ) ? uint8_t( ( crc << 1 ) ^ 0x07 ) : uint8_t( crc << 1 );
+		}
+	}
+	return crc;
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an empty reader group.
+
+reader_group::reader_group():
+	readers(),
+	priorities(),
+	busy(),
+	size_readers( 0 ),
+	next( 0 ),
+	taps( 0 ),
+	start_us( hwlib::now_us() )
+	{}
+
+/// \brief
+/// Function to add a reader to the group.
+/// \details
+/// Readers with a higher priority are served first when several have a
+/// card at the same time. Returns false when the group is full.
+
+bool reader_group::add( pn532 & reader, const uint8_t priority ) {
+
+	if( size_readers >= READER_GROUP_MAX ) {
+		return false;
+	}
+	readers[ size_readers ] = &reader;
+	priorities[ size_readers ] = priority;
+	busy[ size_readers ] = false;
+	size_readers += 1;
+	return true;
+}
+
+/// \brief
+/// Function to serve the readers, call this as often as possible.
+/// \details
+/// Every idle reader gets an InListPassiveTarget, which only takes the bus
+/// for the frame and its ACK. The status of the busy readers is then
+/// checked once each. Of the readers with a card the one with the highest
+/// priority is read, readers of equal priority take turns. Returns true with
+/// the index of that reader and its card, the card is the active target of
+/// that reader and stays so until the next poll(). Returns false without
+/// waiting when no reader has a card.
+///
+/// A card that stays in the field is reported again, just like calling
+/// get_card_uid() in a loop.
+
+bool reader_group::poll( size_t & reader, pn532_target & target ) {
+
+	for( size_t i = 0; i < size_readers; i++ ) {
+		
+		if( !busy[i] ) {
+			readers[i]->start_list_target();
+			busy[i] = true;
+		}
+		
+	}
+	
+	bool found = false;
+	size_t chosen = 0;
+	for( size_t n = 0; n < size_readers; n++ ) {
+		
+		const size_t i = ( next + n ) % size_readers;
+		if( found && priorities[i] <= priorities[ chosen ] ) {
+			continue;
+		}
+		if( readers[i]->response_ready() ) {
+			found = true;
+			chosen = i;
+		}
+		
+	}
+	if( !found ) {
+		return false;
+	}
+	
+	busy[ chosen ] = false;
+	next = ( chosen + 1 ) % size_readers;
+	if( !readers[ chosen ]->finish_list_target( target ) ) {
+		return false;
+	}
+	reader = chosen;
+	taps += 1;
+	return true;
+}
+
+/// \brief
+/// Function returning the amount of cards reported by poll().
+
+uint32_t reader_group::tap_count() const {
+
+	return taps;
+}
+
+/// \brief
+/// Function returning the cards reported per second by poll(), times 100.
+
+uint32_t reader_group::taps_per_second_x100() const {
+
+	const uint_fast64_t elapsed_us = hwlib::now_us() - start_us;
+	if( elapsed_us == 0 ) {
+		return 0;
+	}
+	return uint32_t( uint_fast64_t( taps ) * 100000000 / elapsed_us );
+}
+
+/// \brief
+/// Function to restart tap_count() and taps_per_second_x100() from zero.
+
+void reader_group::reset_statistics() {
+
+	taps = 0;
+	start_us = hwlib::now_us();
+
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of a multiplexer at address on bus, no channel is selected.
+
+i2c_mux::i2c_mux( hwlib::i2c_bus & bus, const uint8_t address ):
+	bus( bus ),
+	address( address ),
+	channel( MUX_NO_CHANNEL ),
+	switches( 0 )
+	{}
+
+/// \brief
+/// Function to select a channel, nothing is written when it is selected already.
+
+void i2c_mux::select( const uint8_t channel ) {
+
+	if( channel == this->channel || channel >= MUX_CHANNELS ) {
+		return;
+	}
+	bus.write( address ).write( uint8_t( 1 << channel ) );
+	this->channel = channel;
+	switches += 1;
+
+}
+
+/// \brief
+/// Function returning the bus the multiplexer and the readers behind it share.
+
+hwlib::i2c_bus & i2c_mux::get_bus() {
+
+	return bus;
+}
+
+/// \brief
+/// Function returning the selected channel, MUX_NO_CHANNEL when unknown.
+
+uint8_t i2c_mux::selected() const {
+
+	return channel;
+}
+
+/// \brief
+/// Function returning the amount of times the channel was written.
+
+uint32_t i2c_mux::switch_count() const {
+
+	return switches;
+}
+
+/// \brief
+/// Function to forget the selected channel.
+/// \details
+/// Call this when something else wrote the multiplexer, or after it was
+/// reset, so the next select() writes the channel again.
+
+void i2c_mux::invalidate() {
+
+	channel = MUX_NO_CHANNEL;
+
+}
+
+// ==========================================================================
+
+/// \brief
+/// Constructor of an empty batch for the readers behind mux.
+
+i2c_mux_batch::i2c_mux_batch( i2c_mux & mux ):
+	mux( mux ),
+	entries(),
+	size_entries( 0 )
+	{}
+
+/// \brief
+/// Function to add an operation on reader, returns false when the batch is full.
+/// \details
+/// context is passed to operation as is, for example a pointer to where
+/// the operation stores its result.
+
+bool i2c_mux_batch::add( pn532 & reader, mux_operation operation, void * context ) {
+
+	if( size_entries >= MUX_BATCH_MAX ) {
+		return false;
+	}
+	entries[ size_entries++ ] = { &reader, operation, context };
+	return true;
+}
+
+/// \brief
+/// Function to run all operations grouped by channel and empty the batch.
+/// \details
+/// Readers without a multiplexer go first, then the selected channel and
+/// the channels after it. Returns the amount of times the channel was
+/// switched.
+
+uint32_t i2c_mux_batch::run() {
+
+	const uint32_t switches = mux.switch_count();
+	const uint8_t first = mux.selected() < MUX_CHANNELS ? mux.selected() : 0;
+	
+	for( size_t n = 0; n <= MUX_CHANNELS; n++ ) {
+		
+		const uint8_t channel = n == 0 ? MUX_NO_CHANNEL : ( first + n - 1 ) % MUX_CHANNELS;
+		for( size_t i = 0; i < size_entries; i++ ) {
+			
+			if( entries[i].reader->get_mux_channel() == channel ) {
+				entries[i].operation( *entries[i].reader, entries[i].context );
+			}
+			
+		}
+		
+	}
+	
+	clear();
+	return mux.switch_count() - switches;
+}
+
+/// \brief
+/// Function to empty the batch without running it.
+
+void i2c_mux_batch::clear() {
+
+	size_entries = 0;
+
+}
@@ -22,6 +22,53 @@
 
 // ==========================================================================
 
+// Console output of the library. Printing to the console is slow (a single
+// block dump takes hundreds of milliseconds at 2400 baud.), so every line
+// has a level and all lines above PN532_LOG_LEVEL are compiled away.
+// Production builds can add -DPN532_LOG_LEVEL=0 to their PROJECT_CPP_FLAGS.
+
+/// \brief
+/// Log level without any console output.
+#define PN532_LOG_NONE 0
+
+/// \brief
+/// Log level that only prints errors.
+#define PN532_LOG_ERROR 1
+
+/// \brief
+/// Log level that also prints progress messages, such as waiting for a card.
+#define PN532_LOG_INFO 2
+
+/// \brief
+/// Log level that also prints all data read, such as UID's and block dumps.
+#define PN532_LOG_DEBUG 3
+
+#ifndef PN532_LOG_LEVEL
+/// \brief
+/// Highest level of console output that gets compiled in, prints everything by default.
+#define PN532_LOG_LEVEL PN532_LOG_DEBUG
+#endif
+
+#if PN532_LOG_LEVEL >= PN532_LOG_ERROR
+#define PN532_ERROR( output ) hwlib::cout << output
+#else
+#define PN532_ERROR( output ) ( (void) 0 )
+#endif
+
+#if PN532_LOG_LEVEL >= PN532_LOG_INFO
+#define PN532_INFO( output ) hwlib::cout << output
+#else
+#define PN532_INFO( output ) ( (void) 0 )
+#endif
+
+#if PN532_LOG_LEVEL >= PN532_LOG_DEBUG
+#define PN532_DEBUG( output ) hwlib::cout << output
+#else
+#define PN532_DEBUG( output ) ( (void) 0 )
+#endif
+
+// ==========================================================================
+
 // Some defines for convenience and readability.
 // The following bytes are part of all communication frames.
 
@@ -41,6 +88,10 @@
 /// TFI is a byte that shows the direction of frame (0xD4 = arduino to PN532.)
 #define TFI 0xD4
 
+/// \brief
+/// TFI of a frame sent back by the PN532. (0xD5 = PN532 to arduino.)
+#define TFI_PN532 0xD5
+
 /// \brief
 /// The postamble of a communication frame.
 #define POSTAMBLE 0x00
@@ -99,6 +150,74 @@
 /// Command code to get a cards UID.
 #define CC_get_uid 0x4A
 
+/// \brief
+/// Command code to change the bit rate used with an active card.
+#define CC_psl 0x4E
+
+/// \brief
+/// Command code to select a target the PN532 already knows.
+#define CC_in_select 0x54
+
+/// \brief
+/// Command code to deselect a target, the PN532 keeps its information.
+#define CC_in_deselect 0x44
+
+/// \brief
+/// Command code to release a target, the PN532 forgets it.
+#define CC_in_release 0x52
+
+/// \brief
+/// Command code to run one of the PN532's self tests.
+#define CC_diagnose 0x36
+
+/// \brief
+/// Add-on to CC_diagnose, attention request test. (ISO14443-4 card presence check.)
+#define diagnose_attention 0x06
+
+/// \brief
+/// Command code to change the internal settings of the PN532.
+#define CC_set_parameters 0x12
+
+/// \brief
+/// Command code to let the PN532 wait until a reader activates it as a card.
+#define CC_tg_init_as_target 0x8C
+
+/// \brief
+/// Command code to receive a command from the reader while acting as a card.
+#define CC_tg_get_data 0x86
+
+/// \brief
+/// Command code to answer the reader while acting as a card.
+#define CC_tg_set_data 0x8E
+
+/// \brief
+/// Command code to activate another NFCIP-1 device for peer to peer data exchange (DEP.)
+#define CC_in_jump_for_dep 0x56
+
+/// \brief
+/// Command code to send a part of a chained answer while acting as a target.
+#define CC_tg_set_meta_data 0x94
+
+/// \brief
+/// Command code to send raw data to the card, no protocol is added by the PN532.
+#define CC_in_communicate_thru 0x42
+
+/// \brief
+/// Command code to read registers of the PN532.
+#define CC_read_register 0x06
+
+/// \brief
+/// Command code to write registers of the PN532.
+#define CC_write_register 0x08
+
+/// \brief
+/// Command code to change the RF settings of the PN532.
+#define CC_rf_configuration 0x32
+
+/// \brief
+/// Add-on to CC_rf_configuration for the amount of retries of activations.
+#define rf_max_retries 0x05
+
 /// \brief
 /// Command code to read from the GPIO.
 #define CC_read_gpio 0x0C
@@ -121,12 +240,581 @@
 /// Add-on to CC_data_exchange for writing NFC card eeprom.
 #define mifare_write 0xA0
 
+/// \brief
+/// Add-on to CC_data_exchange for authenticating with key A.
+#define mifare_auth_a 0x60
+
+/// \brief
+/// Add-on to CC_data_exchange for authenticating with key B.
+#define mifare_auth_b 0x61
+
+/// \brief
+/// Add-on to CC_data_exchange for incrementing a value block into the transfer buffer.
+#define mifare_increment 0xC1
+
+/// \brief
+/// Add-on to CC_data_exchange for decrementing a value block into the transfer buffer.
+#define mifare_decrement 0xC0
+
+/// \brief
+/// Add-on to CC_data_exchange for copying a value block into the transfer buffer.
+#define mifare_restore 0xC2
+
+/// \brief
+/// Add-on to CC_data_exchange for writing the transfer buffer to a value block.
+#define mifare_transfer 0xB0
+
 /// \brief
 /// Add-on for mifare write/read to specify which card we target. (Always 0x01.)
 #define target_card 0x01
 
 // ==========================================================================
 
+// Bit rates for InPSL and the ISO14443-4 bits they depend on.
+
+/// \brief
+/// Bit rate of 106 kbps, every card starts at this rate.
+#define BR_106 0x00
+
+/// \brief
+/// Bit rate of 212 kbps.
+#define BR_212 0x01
+
+/// \brief
+/// Bit rate of 424 kbps.
+#define BR_424 0x02
+
+/// \brief
+/// Bit in the SEL_RES (SAK) of a card telling it supports ISO14443-4 (ISO-DEP.)
+#define SAK_iso_dep 0x20
+
+/// \brief
+/// Largest amount of ATS bytes remembered of the active card.
+#define ATS_MAX 20
+
+// ==========================================================================
+
+// CIU (contactless interface unit.) registers and the bits the library uses.
+
+/// \brief
+/// CIU_TxMode register, bit 7 enables the CRC on sent data.
+#define CIU_TxMode 0x6302
+
+/// \brief
+/// CIU_RxMode register, bit 7 enables the CRC check on received data.
+#define CIU_RxMode 0x6303
+
+/// \brief
+/// CIU_ManualRCV register, bit 4 disables parity on sent and received data.
+#define CIU_ManualRCV 0x630D
+
+/// \brief
+/// CRC enable bit of CIU_TxMode and CIU_RxMode.
+#define CIU_CRC_enable 0x80
+
+/// \brief
+/// Parity disable bit of CIU_ManualRCV.
+#define CIU_parity_disable 0x10
+
+/// \brief
+/// Largest amount of registers read or written with a single frame.
+#define REGISTERS_MAX 64
+
+/// \brief
+/// Largest amount of steps a gpio_sequence can hold.
+#define GPIO_SEQUENCE_MAX 16
+
+/// \brief
+/// Largest amount of readers a reader_group can hold.
+#define READER_GROUP_MAX 8
+
+/// \brief
+/// Amount of channels of an I2C multiplexer, see class i2c_mux.
+#define MUX_CHANNELS 8
+
+/// \brief
+/// Channel number of a reader that is not behind a multiplexer, or of a multiplexer with no channel selected yet.
+#define MUX_NO_CHANNEL 0xFF
+
+/// \brief
+/// Largest amount of operations an i2c_mux_batch can hold.
+#define MUX_BATCH_MAX 16
+
+/// \brief
+/// Cascade tag, the first byte of every cascade level of a 7 or 10 byte UID but the last.
+#define cascade_tag 0x88
+
+/// \brief
+/// Largest amount of UID's a uid_set can hold.
+#define UID_SET_MAX 32
+
+/// \brief
+/// Largest amount of registers the register shadow cache can hold.
+#define SHADOW_MAX 16
+
+// ==========================================================================
+
+// Binary trace records, see class pn532_trace.
+// A record is TRACE_SYNC, type, length, payload and a CRC-8 over type,
+// length and payload. Multi byte values are sent least significant byte first.
+
+/// \brief
+/// First byte of every trace record.
+#define TRACE_SYNC 0xA5
+
+/// \brief
+/// Largest payload of a trace record.
+#define TRACE_PAYLOAD_MAX 32
+
+/// \brief
+/// Trace record of a card in the field: SENS_RES (2), SEL_RES (1), UID (4, 7 or 10.)
+#define trace_uid 0x01
+
+/// \brief
+/// Trace record of a block read: block number, status byte, data (16.)
+#define trace_block 0x02
+
+/// \brief
+/// Trace record of the counters: milliseconds since start (4), frames written (4.)
+#define trace_stats 0x03
+
+// ==========================================================================
+
+// Flags for SetParameters.
+
+/// \brief
+/// SetParameters flag: the NAD (node address.) is used in ISO14443-4 and DEP exchanges.
+#define param_nad_used 0x01
+
+/// \brief
+/// SetParameters flag: the DID (device identifier.) is used in ISO14443-4 and DEP exchanges.
+#define param_did_used 0x02
+
+/// \brief
+/// SetParameters flag: the PN532 answers ATR_REQ itself when acting as target.
+#define param_automatic_atr_res 0x04
+
+/// \brief
+/// SetParameters flag: the PN532 sends RATS itself when activating ISO14443-4 cards.
+#define param_automatic_rats 0x10
+
+/// \brief
+/// SetParameters flag: the PN532 handles the ISO14443-4 protocol when acting as a card.
+#define param_iso14443_4_picc 0x20
+
+// ==========================================================================
+
+// Card emulation of an NFC Forum type 4 tag.
+
+/// \brief
+/// Largest NDEF message an emulated type 4 tag can serve.
+#define NDEF_TAG_MESSAGE_MAX 254
+
+/// \brief
+/// Largest part of the NDEF file answered at once. (MLe of the capability container.)
+#define NDEF_TAG_CHUNK 0x80
+
+// ==========================================================================
+
+// NDEF TLV types and record header bits.
+
+/// \brief
+/// NULL TLV, a single padding byte without length.
+#define tlv_null 0x00
+
+/// \brief
+/// NDEF message TLV.
+#define tlv_ndef 0x03
+
+/// \brief
+/// Terminator TLV, nothing follows.
+#define tlv_terminator 0xFE
+
+/// \brief
+/// NDEF record header: message begin.
+#define ndef_mb 0x80
+
+/// \brief
+/// NDEF record header: message end.
+#define ndef_me 0x40
+
+/// \brief
+/// NDEF record header: chunked record.
+#define ndef_cf 0x20
+
+/// \brief
+/// NDEF record header: short record, 1 byte payload length.
+#define ndef_sr 0x10
+
+/// \brief
+/// NDEF record header: ID length present.
+#define ndef_il 0x08
+
+/// \brief
+/// NDEF record header: type name format (TNF) bits.
+#define ndef_tnf 0x07
+
+/// \brief
+/// TNF of NFC Forum well known types, such as "U" (URI) and "T" (text.)
+#define tnf_well_known 0x01
+
+/// \brief
+/// TNF of MIME media types.
+#define tnf_mime 0x02
+
+// ==========================================================================
+
+// Card types (BrTy) for InListPassiveTarget and the FeliCa commands.
+
+/// \brief
+/// BrTy for 106 kbps type A cards. (ISO14443A / MIFARE.)
+#define brty_106a 0x00
+
+/// \brief
+/// BrTy for 212 kbps FeliCa cards.
+#define brty_felica_212 0x01
+
+/// \brief
+/// BrTy for 424 kbps FeliCa cards.
+#define brty_felica_424 0x02
+
+/// \brief
+/// BrTy for 106 kbps Innovision Jewel / Topaz cards. (NFC Forum type 1.)
+#define brty_jewel 0x04
+
+/// \brief
+/// FeliCa polling command, sent as InitiatorData when listing FeliCa cards.
+#define felica_polling 0x00
+
+/// \brief
+/// FeliCa Read Without Encryption command.
+#define felica_read_no_enc 0x06
+
+/// \brief
+/// Largest amount of blocks most FeliCa cards return for one Read Without Encryption.
+#define FELICA_BLOCKS_MAX 15
+
+/// \brief
+/// Jewel / Topaz READALL command, returns the header ROM and all static memory.
+#define jewel_rall 0x00
+
+/// \brief
+/// Amount of static memory bytes of a Jewel / Topaz card.
+#define JEWEL_MEMORY_SIZE 120
+
+// ==========================================================================
+
+/// \brief
+/// Largest amount of data bytes (TFI excluded) that fits in a normal information frame.
+#define FRAME_NORMAL_MAX 254
+
+/// \brief
+/// Largest amount of data bytes (TFI excluded) that fits in an extended information frame.
+#define FRAME_DATA_MAX 264
+
+/// \brief
+/// Largest amount of card data in a single InDataExchange frame, larger amounts are chained.
+#define EXCHANGE_DATA_MAX 262
+
+/// \brief
+/// Bit in the InDataExchange target and status byte telling more information follows.
+#define MI_bit 0x40
+
+/// \brief
+/// Status byte of the PN532 when the card did not answer in time, in other words it left the field.
+#define status_timeout 0x01
+
+/// \brief
+/// Status byte of the PN532 when the reader released it while it acted as a card.
+#define status_released 0x29
+
+/// \brief
+/// Status returned by data_exchange() when the PN532 did not send back a valid frame.
+#define status_no_frame 0xFF
+
+/// \brief
+/// Status returned by data_exchange() when the answer of the card did not fit the caller's buffer.
+#define status_overflow 0xFE
+
+// ==========================================================================
+
+/// \brief
+/// Result of a command, a value or the reason there is none.
+/// \details
+/// status is 0x00 when value holds what the command read. Otherwise it is
+/// the status byte of the PN532 (see the status_* defines.) and value is
+/// left default.
+
+template< typename T >
+struct pn532_result {
+	
+	uint8_t status = status_no_frame;
+	T value = {};
+	
+	/// Returns whether value holds what the command read.
+	bool ok() const {
+		return status == 0x00;
+	}
+	
+};
+
+/// \brief
+/// Firmware information of the PN532, see pn532::read_firmware().
+
+struct pn532_firmware {
+	
+	/// IC version, 0x32 for the PN532.
+	uint8_t ic = 0;
+	
+	uint8_t version = 0;
+	uint8_t revision = 0;
+	
+	/// Supported card types, 1 = ISO/IEC 14443 TypeA, 2 = TypeB, 4 = ISO18092.
+	uint8_t support = 0;
+	
+};
+
+/// \brief
+/// States of the GPIO ports, see pn532::read_gpio() for the formats.
+
+struct pn532_gpio {
+	
+	uint8_t p3 = 0;
+	uint8_t p7 = 0;
+	
+	/// Interface select jumpers, 0x01 for I2C and 0x02 for SPI.
+	uint8_t interface = 0;
+	
+};
+
+// ==========================================================================
+
+/// \brief
+/// Handle of a card activated by the PN532.
+/// \details
+/// Filled by pn532::list_target() with the logical target number the PN532
+/// gave the card and everything the card told about itself during its
+/// activation. Pass it back to pn532::activate_target() to run further
+/// commands on the same card without a new anticollision cycle.
+
+struct pn532_target {
+	
+	/// Logical target number given by the PN532, 0 when no card is held.
+	uint8_t tg = 0;
+	
+	/// SENS_RES (ATQA) of the card.
+	uint16_t sens_res = 0;
+	
+	/// SEL_RES (SAK) of the card.
+	uint8_t sel_res = 0;
+	
+	/// UID of the card, uid_size bytes are used.
+	std::array<uint8_t, 10> uid = {};
+	uint8_t uid_size = 0;
+	
+	/// ATS of ISO14443-4 cards, ats_size bytes are used.
+	std::array<uint8_t, ATS_MAX> ats = {};
+	uint8_t ats_size = 0;
+	
+	/// Bit rate currently used with the card, see pn532::negotiate_bit_rate().
+	uint8_t bit_rate = BR_106;
+	
+	/// Card type the card was found with. (BrTy of InListPassiveTarget.)
+	uint8_t brty = brty_106a;
+	
+	/// PMm of FeliCa cards, their IDm is kept in uid.
+	std::array<uint8_t, 8> pmm = {};
+	
+};
+
+// ==========================================================================
+
+/// \brief
+/// Result of pn532::check_presence().
+/// \details
+/// removed is returned once, by the first check that notices the card is
+/// gone, after that absent is returned until a new card is activated.
+
+enum class card_presence : uint8_t { absent, present, removed };
+
+// ==========================================================================
+
+/// \brief
+/// Protocol steps the PN532 firmware takes care of itself.
+/// \details
+/// Passed to pn532::set_parameters(). Every step the firmware performs is
+/// an exchange the host does not have to drive, the defaults match the
+/// settings of the PN532 after a reset.
+
+struct pn532_parameters {
+	
+	/// Use the NAD (node address.) in ISO14443-4 and DEP exchanges.
+	bool nad_used = false;
+	
+	/// Use the DID (device identifier.) in ISO14443-4 and DEP exchanges.
+	bool did_used = false;
+	
+	/// Answer the ATR_REQ of an initiator automatically when acting as DEP target.
+	bool automatic_atr_res = true;
+	
+	/// Send RATS automatically when activating an ISO14443-4 card, its ATS
+	/// then comes with the answer to InListPassiveTarget.
+	bool automatic_rats = true;
+	
+	/// Handle the ISO14443-4 protocol (RATS, blocks, chaining.) when emulating a card.
+	bool iso14443_4_picc = false;
+	
+};
+
+// ==========================================================================
+
+/// \brief
+/// One entry of a card emulation response table.
+/// \details
+/// An entry answers every command APDU that starts with the size_command
+/// bytes of command, as long as file is the selected file (0 matches any.)
+/// The answer is a complete TgSetData frame, see pn532::build_frame(), so it
+/// can be written to the PN532 as is. A non zero select becomes the selected
+/// file after answering. Entries for answers that never change can point
+/// to const arrays, which stay in flash.
+
+struct emulation_response {
+	
+	uint16_t file;
+	const uint8_t * command;
+	uint8_t size_command;
+	const uint8_t * frame;
+	uint16_t size_frame;
+	uint16_t select;
+	
+};
+
+// ==========================================================================
+
+/// \brief
+/// View of an NDEF record.
+/// \details
+/// Filled by ndef_parser::next_record(), the pointers point into the
+/// caller's buffer that holds the card image, nothing is copied.
+
+struct ndef_record {
+	
+	/// Record header, see the ndef_* defines.
+	uint8_t header = 0;
+	
+	/// Type name format, see the tnf_* defines.
+	uint8_t tnf = 0;
+	
+	const uint8_t * type = nullptr;
+	uint8_t size_type = 0;
+	
+	const uint8_t * id = nullptr;
+	uint8_t size_id = 0;
+	
+	const uint8_t * payload = nullptr;
+	uint32_t size_payload = 0;
+	
+};
+
+// ==========================================================================
+
+/// \brief
+/// UID of a card with its SENS_RES (ATQA) and SEL_RES (SAK.)
+/// \details
+/// Holds UID's of 4, 7 or 10 bytes without padding. key() packs the length
+/// and the bytes of a 4 or 7 byte UID into a single 64 bit value, so a 4
+/// byte UID never equals a 7 byte UID ending in zeros and comparing or
+/// hashing is a single integer operation. 10 byte UID's do not fit, their
+/// key is a hash and equality falls back to comparing the bytes.
+
+class card_uid {
+private:
+
+	std::array<uint8_t, 10> bytes;
+	uint8_t size_bytes;
+	uint16_t sens_res_card;
+	uint8_t sel_res_card;
+	uint64_t packed;
+	
+	void pack();
+
+public:
+
+	card_uid();
+	card_uid( const uint8_t uid[], const size_t & size_uid, const uint16_t sens_res = 0, const uint8_t sel_res = 0 );
+	card_uid( const pn532_target & target );
+	const uint8_t * data() const;
+	size_t size() const;
+	uint16_t sens_res() const;
+	uint8_t sel_res() const;
+	bool packable() const;
+	uint64_t key() const;
+	bool operator==( const card_uid & other ) const;
+	bool operator!=( const card_uid & other ) const;
+
+}; // class card_uid.
+
+// ==========================================================================
+
+/// \brief
+/// Fixed capacity set of card UID's.
+/// \details
+/// Holds up to UID_SET_MAX UID's of up to 10 bytes without using the heap,
+/// used to collect every card in the field, see pn532::enumerate_targets(),
+/// or as an allow list. Lookups compare card_uid::key() values.
+
+class uid_set {
+private:
+
+	std::array<card_uid, UID_SET_MAX> uids;
+	size_t count;
+
+public:
+
+	uid_set();
+	bool contains( const card_uid & uid ) const;
+	bool contains( const uint8_t uid[], const size_t & size_uid ) const;
+	bool insert( const card_uid & uid );
+	bool insert( const uint8_t uid[], const size_t & size_uid );
+	const card_uid & at( const size_t & index ) const;
+	size_t size() const;
+	const uint8_t * uid( const size_t & index ) const;
+	size_t size_uid( const size_t & index ) const;
+	void clear();
+
+}; // class uid_set.
+
+// ==========================================================================
+
+/// \brief
+/// TCA9548A style I2C multiplexer.
+/// \details
+/// Every PN532 answers at I2C address 0x24, so several readers on one bus
+/// each sit behind their own channel of a multiplexer. The multiplexer
+/// remembers the selected channel, select() only writes it when it changes.
+/// See the multiplexer constructor of pn532.
+
+class i2c_mux {
+private:
+
+	hwlib::i2c_bus & bus;
+	const uint8_t address;
+	uint8_t channel;
+	uint32_t switches;
+
+public:
+
+	i2c_mux( hwlib::i2c_bus & bus, const uint8_t address = 0x70 );
+	void select( const uint8_t channel );
+	hwlib::i2c_bus & get_bus();
+	uint8_t selected() const;
+	uint32_t switch_count() const;
+	void invalidate();
+
+}; // class i2c_mux.
+
+// ==========================================================================
+
 /// \brief
 /// pn532 class supporting both i2c and spi
 /// \details
@@ -145,7 +833,7 @@ private:
 	hwlib::pin_oc & sda;
 	hwlib::i2c_bus_bit_banged_scl_sda i2c_bus;
 	hwlib::target::pin_out rst;
-	const uint8_t & addr;
+	const uint8_t addr;
 	
 	// SPI required variables.
 	hwlib::spi_bus_bit_banged_sclk_mosi_miso spi_bus;
@@ -156,6 +844,55 @@ private:
 	const bool using_i2c;
 	const bool irq_present;
 	
+	// The card commands are sent to, and whether it is still selected.
+	pn532_target target_active;
+	bool target_selected;
+	
+	// Last CRC and parity settings written for InCommunicateThru.
+	bool raw_settings_known;
+	bool raw_crc;
+	bool raw_parity;
+	
+	// Shadow copies of registers only the host modifies.
+	struct register_shadow {
+		uint16_t address;
+		uint8_t value;
+		bool known;
+	};
+	std::array<register_shadow, SHADOW_MAX> shadow;
+	size_t shadow_size;
+	
+	// Last parameters sent with SetParameters.
+	pn532_parameters parameters_active;
+	bool parameters_known;
+	
+	// Amount of frames written to the PN532, see exchange_count().
+	uint32_t exchanges;
+	
+	// Command code of the last frame written, see read_response().
+	uint8_t command_sent;
+	
+	// Activation retries set with RFConfiguration, 0xFF (forever.) after a reset.
+	uint8_t passive_retries;
+	
+	// GPIO states written to the PN532, changes waiting for flush_gpio() and
+	// pins used as inputs. Known once the constructor has written port 3.
+	uint8_t gpio_p3;
+	uint8_t gpio_p7;
+	uint8_t gpio_pending_p3;
+	uint8_t gpio_pending_p7;
+	uint8_t gpio_input_p3;
+	uint8_t gpio_input_p7;
+	bool gpio_known;
+	
+	// Multiplexer and channel the PN532 is behind, see i2c_mux.
+	i2c_mux * mux;
+	uint8_t mux_channel;
+	
+	// Presence checking of the active target.
+	uint_fast64_t presence_interval_us;
+	uint_fast64_t presence_checked_us;
+	
 	//General functions used by other functions.
 	void pn532_reset();
 	void samconfig();
@@ -163,24 +900,365 @@ private:
 	bool read_ack_nack();
 	void write( const uint8_t bytes_out[], const size_t & size_out, uint8_t timeout = 5 );
 	void read( uint8_t bytes_in[], const size_t & size_in );
+	void write_command( const uint8_t command[], const size_t & size_command );
+	bool read_response( uint8_t response[], size_t & size_response );
+	size_t exchange_part( const bool more, const uint8_t command[], const size_t & size_command, uint8_t bytes_in[], const size_t & size_room );
+	uint8_t value_operation( const uint8_t operation, const uint8_t blocknr, const uint32_t operand );
+	bool read_target( pn532_target & target, const uint8_t brty = brty_106a );
+	bool gpio_pin_bit( const uint8_t pin, uint8_t * & port, uint8_t & bit );
+	void sync_pending_gpio( const bool & port_p3, const bool & port_p7 );
+	bool read_register_frame( const uint16_t addresses[], uint8_t values[], const size_t & count );
+	bool write_register_frame( const uint16_t addresses[], const uint8_t values[], const size_t & count );
+	register_shadow * find_shadow( const uint16_t address );
+	bool set_register_bits( const uint16_t addresses[], const uint8_t bits[], const bool set, const size_t & count );
+	uint8_t target_command( const uint8_t command_code, const uint8_t tg );
+	void select_channel();
+	hwlib::i2c_bus & active_bus();
 
 public:
 
 	//I2C constructor.
 	pn532( hwlib::pin_oc & scl, hwlib::pin_oc & sda, hwlib::target::pin_out rst, hwlib::target::pin_in irq = hwlib::target::pins::d13, const bool irq_present = false, const uint8_t & addr = 0x24 );
 	
+	//I2C constructor for a PN532 behind a multiplexer.
+	pn532( i2c_mux & mux, const uint8_t channel, hwlib::target::pin_out rst, hwlib::target::pin_in irq = hwlib::target::pins::d13, const bool irq_present = false, const uint8_t addr = 0x24 );
+	
 	//SPI constructor.
 	pn532( hwlib::spi_bus_bit_banged_sclk_mosi_miso & spi_bus, hwlib::pin_out & sel, hwlib::target::pin_out rst, hwlib::target::pin_in irq = hwlib::target::pins::d13, const bool irq_present = false );
 	
 	//Functions for both I2C and SPI.
 	void get_firmware_version( std::array<uint8_t, 4> & firmware );
 	void read_gpio( std::array<uint8_t, 3> & gpio_states );
-	void write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 );
+	bool write_gpio( uint8_t gpio_p3, uint8_t gpio_p7 );
+	bool set_pin( const uint8_t pin );
+	bool clear_pin( const uint8_t pin );
+	bool toggle( const uint8_t pin );
+	bool flush_gpio();
+	void watch_gpio_inputs( const uint8_t inputs_p3, const uint8_t inputs_p7 );
+	uint8_t get_mux_channel() const;
 	void get_card_uid( std::array<uint8_t, 7> & uid );
+	void get_card_uid( card_uid & uid );
 	void read_eeprom_block( const uint8_t blocknr );
-	void write_eeprom_block( const uint8_t blocknr, const std::array<uint8_t, 16> & data );
+	bool read_eeprom_block( const uint8_t blocknr, std::array<uint8_t, 16> & data );
+	uint8_t write_eeprom_block( const uint8_t blocknr, const std::array<uint8_t, 16> & data );
 	void read_eeprom_all();
+	uint8_t data_exchange( const uint8_t command[], const size_t & size_command, uint8_t response[], size_t & size_response );
+	
+	//Typed results of the functions above, nothing gets printed.
+	pn532_result<pn532_firmware> read_firmware();
+	pn532_result<pn532_gpio> read_gpio_state();
+	pn532_result<pn532_target> read_card();
+	pn532_result<std::array<uint8_t, 16>> read_block( const uint8_t blocknr );
+	
+	//Target lifecycle functions.
+	bool list_target( pn532_target & target );
+	bool list_target( pn532_target & target, const uint8_t uid[], const size_t & size_uid );
+	void start_list_target();
+	bool response_ready();
+	bool finish_list_target( pn532_target & target );
+	bool activate_target( const pn532_target & target );
+	bool deselect_target();
+	bool release_target();
+	
+	//FeliCa functions.
+	bool list_felica_target( pn532_target & target, const uint16_t system_code = 0xFFFF, const uint8_t brty = brty_felica_212 );
+	bool felica_read( const uint16_t service_code, const uint16_t blocks[], const size_t & number_of_blocks, uint8_t data[], const size_t & blocks_per_exchange = FELICA_BLOCKS_MAX );
+	
+	//Jewel / Topaz functions.
+	bool list_jewel_target( pn532_target & target );
+	bool jewel_read_all( std::array<uint8_t, JEWEL_MEMORY_SIZE> & data, uint16_t & header_rom );
+	
+	//Card emulation functions.
+	static size_t build_frame( const uint8_t command[], const size_t & size_command, uint8_t bytes_out[] );
+	bool init_as_target( const std::array<uint8_t, 3> & nfcid1 );
+	bool emulate_target( const emulation_response table[], const size_t & size_table );
+	
+	//Peer to peer (NFCIP-1 DEP) functions.
+	bool dep_initiate( const uint8_t bit_rate = BR_424, const bool active = true );
+	bool init_as_dep_target( const std::array<uint8_t, 10> & nfcid3 );
+	uint8_t dep_receive( uint8_t data[], size_t & size_data );
+	uint8_t dep_send( const uint8_t data[], const size_t & size_data );
+	
+	//Settings and statistics functions.
+	bool set_parameters( const pn532_parameters & parameters );
+	uint32_t exchange_count() const;
+	void reset_exchange_count();
+	
+	//Register functions.
+	bool read_registers( const uint16_t addresses[], uint8_t values[], const size_t & count );
+	bool write_registers( const uint16_t addresses[], const uint8_t values[], const size_t & count );
+	bool shadow_register( const uint16_t address );
+	void invalidate_shadow();
+	
+	//Raw transceive functions.
+	bool set_crc( const bool enable );
+	bool set_parity( const bool enable );
+	uint8_t communicate_thru( const uint8_t data[], const size_t & size_data, uint8_t response[], size_t & size_response );
+	
+	//Field enumeration functions.
+	bool set_passive_retries( const uint8_t retries );
+	size_t enumerate_targets( uid_set & found, const uint8_t retries = 0x02 );
+	
+	//Card presence functions.
+	bool target_present();
+	void set_presence_interval( const uint32_t interval_ms );
+	card_presence check_presence();
+	
+	//MIFARE Classic authentication and value block functions.
+	bool authenticate_block( const uint8_t blocknr, const std::array<uint8_t, 6> & key, const bool use_key_b = false );
+	static void encode_value_block( const int32_t value, const uint8_t addr, std::array<uint8_t, 16> & data );
+	static bool decode_value_block( const std::array<uint8_t, 16> & data, int32_t & value, uint8_t & addr );
+	bool format_value_block( const uint8_t blocknr, const int32_t value );
+	bool read_value_block( const uint8_t blocknr, int32_t & value );
+	bool increment_value( const uint8_t blocknr, const uint32_t delta );
+	bool decrement_value( const uint8_t blocknr, const uint32_t delta );
+	bool restore_value( const uint8_t blocknr );
+	bool transfer_value( const uint8_t blocknr );
+	
+	//ISO14443-4 (ISO-DEP) functions.
+	uint8_t apdu_transceive( const uint8_t apdu[], const size_t & size_apdu, uint8_t response[], size_t & size_response, uint16_t & status_word );
+	uint8_t negotiate_bit_rate( const uint8_t bit_rate_max = BR_424 );
 
 }; // class pn532.
 
+// ==========================================================================
+
+/// \brief
+/// One step of a gpio_sequence.
+/// \details
+/// gpio_p3 and gpio_p7 use the format of pn532::write_gpio(), the states
+/// are held for duration_ms milliseconds.
+
+struct gpio_step {
+	
+	uint8_t gpio_p3;
+	uint8_t gpio_p7;
+	uint16_t duration_ms;
+	
+};
+
+/// \brief
+/// Non blocking GPIO pattern player.
+/// \details
+/// Plays a pattern of GPIO states, such as an LED animation, without
+/// waiting: update() is called from the main loop, between card commands,
+/// and only writes the GPIO when the current step is over. Card polling
+/// keeps running while the pattern plays.
+
+class gpio_sequence {
+private:
+
+	pn532 & chip;
+	std::array<gpio_step, GPIO_SEQUENCE_MAX> steps;
+	size_t size_steps;
+	size_t current;
+	bool running;
+	bool repeat;
+	uint_fast64_t step_end_us;
+
+public:
+
+	gpio_sequence( pn532 & chip );
+	bool add( const uint8_t gpio_p3, const uint8_t gpio_p7, const uint16_t duration_ms );
+	void clear();
+	void start( const bool repeat = false );
+	void stop();
+	bool update();
+	bool is_running() const;
+
+}; // class gpio_sequence.
+
+// ==========================================================================
+
+/// \brief
+/// Response table of an emulated NFC Forum type 4 tag holding an NDEF message.
+/// \details
+/// Pass table() and size() to pn532::emulate_target() after
+/// pn532::init_as_target() to serve the message to phones and readers.
+///
+/// The answers to READ BINARY are built in advance for the reads phones
+/// make: NLEN (2 bytes at offset 0.), then the message from offset 2 in
+/// parts of NDEF_TAG_CHUNK bytes, as the capability container asks. A
+/// reader that reads other offsets or sizes, for example the whole file
+/// at once, gets 6A82 (file not found.)
+///
+/// The table points into the object itself, so it cannot be copied.
+
+class ndef_type4_tag {
+private:
+
+	std::array<emulation_response, 8> entries;
+	size_t size_entries;
+	
+	// READ BINARY commands and frames of the NDEF file, built by the constructor.
+	std::array<uint8_t, 15> commands;
+	std::array<uint8_t, NDEF_TAG_MESSAGE_MAX + 44> frames;
+
+public:
+
+	ndef_type4_tag( const uint8_t ndef_message[], const size_t & size_message );
+	ndef_type4_tag( const ndef_type4_tag & ) = delete;
+	ndef_type4_tag & operator=( const ndef_type4_tag & ) = delete;
+	const emulation_response * table() const;
+	size_t size() const;
+
+}; // class ndef_type4_tag.
+
+// ==========================================================================
+
+/// \brief
+/// Parser of NDEF messages in a card image.
+/// \details
+/// Walks the TLV's of a card's data area (for example a dump from block 4
+/// of a MIFARE Classic card or page 4 of a type 2 tag.) and the records of
+/// the NDEF messages inside. Everything is returned as views into the
+/// image, the parser copies nothing and uses no heap.
+
+class ndef_parser {
+private:
+
+	const uint8_t * image;
+	size_t size_image;
+	size_t offset_tlv;
+	
+	const uint8_t * message;
+	size_t size_message;
+	size_t offset_record;
+
+public:
+
+	ndef_parser( const uint8_t image[], const size_t & size_image );
+	bool next_message();
+	bool next_record( ndef_record & record );
+
+}; // class ndef_parser.
+
+// ==========================================================================
+
+/// \brief
+/// Encoder of NDEF messages into a card image.
+/// \details
+/// Writes an NDEF message TLV, record by record, straight into the
+/// caller's image buffer. finish() closes the message and pads the image
+/// with zeros to a whole amount of blocks, ready to be written to the card
+/// block by block, with write_eeprom_block() for example.
+
+class ndef_writer {
+private:
+
+	uint8_t * image;
+	size_t size_image;
+	size_t size_block;
+	
+	// Offset of the first record, the size of the message and header of the last record.
+	size_t offset_message;
+	size_t size_message;
+	size_t offset_last_header;
+	bool failed;
+
+public:
+
+	ndef_writer( uint8_t image[], const size_t & size_image, const size_t & size_block = 16 );
+	bool add_record( const uint8_t tnf, const uint8_t type[], const uint8_t & size_type, const uint8_t payload[], const size_t & size_payload );
+	size_t finish();
+
+}; // class ndef_writer.
+
+// ==========================================================================
+
+/// \brief
+/// Writer of binary trace records.
+/// \details
+/// Sends UID's, block data and counters as small framed records instead of
+/// hex text, a UID takes 11 bytes and a block 22 bytes. The records can be
+/// mixed with normal console text, the host tool in "Trace decoder" finds
+/// them by their sync byte and CRC and turns them back into text or JSON.
+
+class pn532_trace {
+private:
+
+	hwlib::ostream & out;
+	
+	void record( const uint8_t type, const uint8_t payload[], const size_t & size_payload );
+
+public:
+
+	pn532_trace( hwlib::ostream & out = hwlib::cout );
+	void uid( const pn532_target & target );
+	void block( const uint8_t blocknr, const uint8_t status, const std::array<uint8_t, 16> & data );
+	void stats( const pn532 & chip );
+	static uint8_t crc8( const uint8_t data[], const size_t & size_data, uint8_t crc = 0 );
+
+}; // class pn532_trace.
+
+// ==========================================================================
+
+/// \brief
+/// Group of readers polled for cards together.
+/// \details
+/// For several PN532's on one SPI bus, each with its own sel pin (or on
+/// separate buses.) Instead of blocking the bus while one PN532 waits for
+/// a card, every reader waits at the same time and poll() only takes the
+/// bus to start commands, check statuses and read the reader that found a
+/// card. Readers in the group must not be used directly while the group
+/// polls them.
+
+class reader_group {
+private:
+
+	std::array<pn532 *, READER_GROUP_MAX> readers;
+	std::array<uint8_t, READER_GROUP_MAX> priorities;
+	std::array<bool, READER_GROUP_MAX> busy;
+	size_t size_readers;
+	size_t next;
+	uint32_t taps;
+	uint_fast64_t start_us;
+
+public:
+
+	reader_group();
+	bool add( pn532 & reader, const uint8_t priority = 0 );
+	bool poll( size_t & reader, pn532_target & target );
+	uint32_t tap_count() const;
+	uint32_t taps_per_second_x100() const;
+	void reset_statistics();
+
+}; // class reader_group.
+
+// ==========================================================================
+
+/// \brief
+/// Operation on a single reader, run by i2c_mux_batch::run().
+typedef void ( * mux_operation )( pn532 & reader, void * context );
+
+/// \brief
+/// Batch of operations on readers behind one I2C multiplexer.
+/// \details
+/// Operations are collected with add() and run() executes them grouped by
+/// channel, starting with the channel that is already selected, so the
+/// multiplexer switches at most once per channel. Operations on the same
+/// reader keep their order.
+
+class i2c_mux_batch {
+private:
+
+	struct entry {
+		pn532 * reader;
+		mux_operation operation;
+		void * context;
+	};
+
+	i2c_mux & mux;
+	std::array<entry, MUX_BATCH_MAX> entries;
+	size_t size_entries;
+
+public:
+
+	i2c_mux_batch( i2c_mux & mux );
+	bool add( pn532 & reader, mux_operation operation, void * context = nullptr );
+	uint32_t run();
+	void clear();
+
+}; // class i2c_mux_batch.
+
 #endif // PN532_HPP
@@ -0,0 +1,488 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "trace-reader.hpp"
+#include "tap-ring.hpp"
+
+// Linux gateway for several readers.
+// Every reader is an Arduino Due running the pn532 library that writes a
+// pn532_trace::uid() record for every card it finds. A thread per reader
+// reads its serial port and pushes the taps into its own lock free queue,
+// the main thread takes them from all queues and sends them as JSON lines
+// to every client connected to a Unix domain socket. Every tap is also
+// written to a shared memory ring, see tap-ring.hpp, for local processes.
+//
+// Usage:
+//   main [--socket path] [--ring name] device...
+//                                       serve the taps of the serial devices
+//   main --simulate readers taps [us]   load test with simulated readers,
+//                                       optionally a tap every us microseconds
+//   main --follow [name]                print the taps of a running gateway
+//                                       from its ring
+
+// Taps a queue can hold, a reader whose queue is full drops its taps.
+#define QUEUE_SIZE 1024
+
+// Serial speed of the readers, CONSOLE_BAUDRATE in Makefile.due.
+#define READER_BAUDRATE B2400
+
+// Queue with a single producer and a single consumer, no locks.
+template< typename T, size_t N >
+class spsc_queue {
+private:
+
+	static_assert( ( N & ( N - 1 ) ) == 0, "N must be a power of 2" );
+	
+	// head is written by the consumer and tail by the producer, the padding
+	// keeps them on separate cache lines.
+	T items[N];
+	std::atomic<size_t> head{ 0 };
+	char padding[64];
+	std::atomic<size_t> tail{ 0 };
+
+public:
+
+	bool push( const T & item ) {
+		
+		const size_t position = tail.load( std::memory_order_relaxed );
+		if( position - head.load( std::memory_order_acquire ) == N ) {
+			return false;
+		}
+		items[ position & ( N - 1 ) ] = item;
+		tail.store( position + 1, std::memory_order_release );
+		return true;
+	}
+	
+	bool pop( T & item ) {
+		
+		const size_t position = head.load( std::memory_order_relaxed );
+		if( position == tail.load( std::memory_order_acquire ) ) {
+			return false;
+		}
+		item = items[ position & ( N - 1 ) ];
+		head.store( position + 1, std::memory_order_release );
+		return true;
+	}
+	
+};
+
+typedef spsc_queue<tap_event, QUEUE_SIZE> tap_queue;
+
+static std::atomic<bool> running{ true };
+
+static uint64_t now_ns() {
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
+
+static void stop( int ) {
+
+	running = false;
+
+}
+
+// Turns the trace records of a single reader into taps on its queue.
+class reader_worker : public trace_reader {
+private:
+
+	const uint32_t index;
+	tap_queue & queue;
+	const int wake_fd;
+	const bool wait_when_full;
+
+protected:
+
+	bool record( const uint8_t type, const uint8_t payload[], const size_t & size_payload ) override {
+		
+		if( type == trace_block || type == trace_stats ) {
+			return true;
+		}
+		if( type != trace_uid || size_payload < 7 || size_payload > 13 ) {
+			return false;
+		}
+		
+		tap_event tap;
+		tap.read_ns = read_ns;
+		tap.reader = index;
+		tap.sens_res = payload[0] | payload[1] << 8;
+		tap.sel_res = payload[2];
+		tap.size_uid = uint8_t( size_payload - 3 );
+		memcpy( tap.uid, payload + 3, tap.size_uid );
+		
+		while( !queue.push( tap ) ) {
+			if( !wait_when_full ) {
+				dropped += 1;
+				return true;
+			}
+			std::this_thread::yield();
+		}
+		const uint64_t one = 1;
+		if( write( wake_fd, &one, sizeof( one ) ) < 0 ) {
+			perror( "eventfd" );
+		}
+		return true;
+	}
+
+public:
+
+	// Time the bytes now being fed were read.
+	uint64_t read_ns = 0;
+	std::atomic<unsigned long> dropped{ 0 };
+	
+	reader_worker( const uint32_t index, tap_queue & queue, const int wake_fd, const bool wait_when_full ):
+		index( index ),
+		queue( queue ),
+		wake_fd( wake_fd ),
+		wait_when_full( wait_when_full )
+		{}
+	
+	// Reads a serial device until the gateway stops.
+	void run_serial( const char * device ) {
+		
+		const int fd = open( device, O_RDONLY | O_NOCTTY );
+		if( fd < 0 ) {
+			perror( device );
+			return;
+		}
+		termios settings;
+		tcgetattr( fd, &settings );
+		cfmakeraw( &settings );
+		cfsetispeed( &settings, READER_BAUDRATE );
+		settings.c_cc[ VMIN ] = 0;
+		settings.c_cc[ VTIME ] = 1;
+		tcsetattr( fd, TCSANOW, &settings );
+		
+		uint8_t bytes[256];
+		while( running ) {
+			const ssize_t size_bytes = read( fd, bytes, sizeof( bytes ) );
+			if( size_bytes < 0 && errno != EINTR ) {
+				perror( device );
+				break;
+			}
+			read_ns = now_ns();
+			feed( bytes, size_bytes > 0 ? size_t( size_bytes ) : 0 );
+		}
+		close( fd );
+		
+	}
+	
+	// Feeds tap records mixed with console text, as a reader would send them.
+	void run_simulated( const unsigned long taps, const unsigned long interval_us ) {
+		
+		const char text[] = "NFC card found!\n";
+		for( unsigned long i = 0; i < taps && running; i++ ) {
+			
+			if( interval_us > 0 ) {
+				std::this_thread::sleep_for( std::chrono::microseconds( interval_us ) );
+			}
+			
+			uint8_t payload[10] = { 0x04, 0x00, 0x08, uint8_t( index ), uint8_t( i ), uint8_t( i >> 8 ), uint8_t( i >> 16 ) };
+			uint8_t bytes[ sizeof( text ) + 14 ];
+			memcpy( bytes, text, sizeof( text ) - 1 );
+			const size_t size_bytes = sizeof( text ) - 1 + trace_encode( trace_uid, payload, 7, bytes + sizeof( text ) - 1 );
+			
+			read_ns = now_ns();
+			feed( bytes, size_bytes );
+			
+		}
+		
+	}
+	
+};
+
+// Formats a tap as a JSON line, returns its length.
+static int format( const tap_event & tap, char line[], const size_t & size_line ) {
+
+	int length = snprintf( line, size_line, "{\"reader\":%u,\"sens_res\":%u,\"sel_res\":%u,\"uid\":\"",
+		tap.reader, tap.sens_res, tap.sel_res );
+	for( size_t i = 0; i < tap.size_uid; i++ ) {
+		length += snprintf( line + length, size_line - length, "%02X", tap.uid[i] );
+	}
+	length += snprintf( line + length, size_line - length, "\"}\n" );
+	return length;
+}
+
+// Sends a tap as a JSON line to every client, clients that do not keep up are dropped.
+static void publish( const tap_event & tap, std::vector<int> & clients ) {
+
+	char line[160];
+	const int size_line = format( tap, line, sizeof( line ) );
+	
+	for( size_t i = 0; i < clients.size(); ) {
+		if( send( clients[i], line, size_line, MSG_DONTWAIT | MSG_NOSIGNAL ) != size_line ) {
+			close( clients[i] );
+			clients.erase( clients.begin() + i );
+		}
+		else {
+			i++;
+		}
+	}
+
+}
+
+// Prints the taps in the ring as JSON lines, as a consumer would read them.
+// Follows the gateway across restarts: a closed ring is mapped again once
+// the new gateway created it.
+static int follow( const char * ring_name ) {
+
+	const tap_ring * ring = tap_ring_map( ring_name, false );
+	if( ring == nullptr ) {
+		fprintf( stderr, "no gateway ring %s\n", ring_name );
+		return 1;
+	}
+	
+	char line[160];
+	tap_event tap;
+	bool overrun;
+	bool replaced = false;
+	while( running ) {
+		tap_ring_reader reader( *ring, replaced );
+		while( running ) {
+			if( reader.next( tap, overrun ) ) {
+				if( overrun ) {
+					fprintf( stderr, "overrun, %lu taps lost so far\n", reader.skipped_count() );
+				}
+				fwrite( line, 1, format( tap, line, sizeof( line ) ), stdout );
+				fflush( stdout );
+			}
+			else if( reader.closed() ) {
+				break;
+			}
+			else {
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+			}
+		}
+		
+		munmap( const_cast<tap_ring *>( ring ), sizeof( tap_ring ) );
+		ring = nullptr;
+		if( running ) {
+			fprintf( stderr, "gateway ring %s closed, waiting for a new one\n", ring_name );
+		}
+		while( running && ( ring = tap_ring_map( ring_name, false ) ) == nullptr ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+		}
+		replaced = true;
+	}
+	if( ring != nullptr ) {
+		munmap( const_cast<tap_ring *>( ring ), sizeof( tap_ring ) );
+	}
+	return 0;
+}
+
+static int listen_socket( const char * path ) {
+
+	const int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0 );
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, path, sizeof( address.sun_path ) - 1 );
+	unlink( path );
+	if( fd < 0
+		|| bind( fd, reinterpret_cast<sockaddr *>( &address ), sizeof( address ) ) < 0
+		|| listen( fd, 8 ) < 0
+	) {
+		perror( path );
+		return -1;
+	}
+	return fd;
+}
+
+int main( int argc, char * argv[] ) {
+
+	const char * socket_path = "/tmp/pn532-gateway.sock";
+	const char * ring_name = TAP_RING_NAME;
+	unsigned long simulated_readers = 0;
+	unsigned long simulated_taps = 0;
+	unsigned long simulated_interval_us = 0;
+	std::vector<const char *> devices;
+	for( int i = 1; i < argc; i++ ) {
+		if( strcmp( argv[i], "--socket" ) == 0 && i + 1 < argc ) {
+			socket_path = argv[ ++i ];
+		}
+		else if( strcmp( argv[i], "--ring" ) == 0 && i + 1 < argc ) {
+			ring_name = argv[ ++i ];
+		}
+		else if( strcmp( argv[i], "--follow" ) == 0 ) {
+			signal( SIGINT, stop );
+			signal( SIGTERM, stop );
+			return follow( i + 1 < argc ? argv[ i + 1 ] : ring_name );
+		}
+		else if( strcmp( argv[i], "--simulate" ) == 0 && i + 2 < argc ) {
+			simulated_readers = strtoul( argv[ ++i ], nullptr, 10 );
+			simulated_taps = strtoul( argv[ ++i ], nullptr, 10 );
+			if( i + 1 < argc && argv[ i + 1 ][0] != '-' ) {
+				simulated_interval_us = strtoul( argv[ ++i ], nullptr, 10 );
+			}
+		}
+		else {
+			devices.push_back( argv[i] );
+		}
+	}
+	const bool simulate = simulated_readers > 0;
+	const size_t readers = simulate ? simulated_readers : devices.size();
+	if( readers == 0 ) {
+		fprintf( stderr, "usage: %s [--socket path] [--ring name] device... | --simulate readers taps [us] | --follow [name]\n", argv[0] );
+		return 1;
+	}
+	
+	signal( SIGINT, stop );
+	signal( SIGTERM, stop );
+	
+	const int wake_fd = eventfd( 0, EFD_NONBLOCK );
+	const int listen_fd = simulate ? -1 : listen_socket( socket_path );
+	const int epoll_fd = epoll_create1( 0 );
+	tap_ring * ring = tap_ring_map( ring_name, true );
+	if( wake_fd < 0 || epoll_fd < 0 || ring == nullptr || ( !simulate && listen_fd < 0 ) ) {
+		perror( "gateway" );
+		return 1;
+	}
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = wake_fd;
+	epoll_ctl( epoll_fd, EPOLL_CTL_ADD, wake_fd, &event );
+	if( listen_fd >= 0 ) {
+		event.data.fd = listen_fd;
+		epoll_ctl( epoll_fd, EPOLL_CTL_ADD, listen_fd, &event );
+	}
+	
+	// A queue and a worker thread per reader.
+	std::vector<std::unique_ptr<tap_queue>> queues;
+	std::vector<std::unique_ptr<reader_worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> finished{ 0 };
+	for( size_t i = 0; i < readers; i++ ) {
+		queues.emplace_back( new tap_queue() );
+		workers.emplace_back( new reader_worker( i, *queues[i], wake_fd, simulate ) );
+	}
+	const uint64_t start_ns = now_ns();
+	for( size_t i = 0; i < readers; i++ ) {
+		reader_worker & worker = *workers[i];
+		const char * device = simulate ? nullptr : devices[i];
+		threads.emplace_back( [ &, device ]() {
+			if( device != nullptr ) {
+				worker.run_serial( device );
+			}
+			else {
+				worker.run_simulated( simulated_taps, simulated_interval_us );
+			}
+			finished += 1;
+			const uint64_t one = 1;
+			if( write( wake_fd, &one, sizeof( one ) ) < 0 ) {
+				perror( "eventfd" );
+			}
+		} );
+	}
+	
+	// The consumer: wakes up for taps, new clients and clients leaving.
+	std::vector<int> clients;
+	std::vector<uint64_t> latencies;
+	if( simulate ) {
+		latencies.reserve( simulated_readers * simulated_taps );
+	}
+	unsigned long taps = 0;
+	int status = 0;
+	while( finished < readers || running ) {
+		
+		epoll_event events[16];
+		const int ready = epoll_wait( epoll_fd, events, 16, 100 );
+		for( int i = 0; i < ready; i++ ) {
+			
+			const int fd = events[i].data.fd;
+			if( fd == wake_fd ) {
+				uint64_t count;
+				while( read( wake_fd, &count, sizeof( count ) ) > 0 ) {}
+			}
+			else if( fd == listen_fd ) {
+				const int client = accept4( listen_fd, nullptr, nullptr, SOCK_NONBLOCK );
+				if( client >= 0 ) {
+					epoll_event hangup = {};
+					hangup.events = EPOLLRDHUP;
+					hangup.data.fd = client;
+					epoll_ctl( epoll_fd, EPOLL_CTL_ADD, client, &hangup );
+					clients.push_back( client );
+				}
+			}
+			else {
+				close( fd );
+				clients.erase( std::remove( clients.begin(), clients.end(), fd ), clients.end() );
+			}
+			
+		}
+		
+		tap_event tap;
+		for( size_t i = 0; i < readers; i++ ) {
+			while( queues[i]->pop( tap ) ) {
+				tap_ring_publish( *ring, tap );
+				publish( tap, clients );
+				if( simulate ) {
+					latencies.push_back( now_ns() - tap.read_ns );
+				}
+				taps += 1;
+			}
+		}
+		
+		if( simulate && finished == readers && taps == simulated_readers * simulated_taps ) {
+			break;
+		}
+		
+		// Every serial reader stopped by itself, nothing is left to serve.
+		if( !simulate && finished == readers && running ) {
+			fprintf( stderr, "no reader left, stopping\n" );
+			status = 1;
+			break;
+		}
+		
+	}
+	
+	running = false;
+	for( std::thread & thread : threads ) {
+		thread.join();
+	}
+	
+	unsigned long dropped = 0;
+	for( const std::unique_ptr<reader_worker> & worker : workers ) {
+		dropped += worker->dropped;
+	}
+	if( simulate && !latencies.empty() ) {
+		const double seconds = ( now_ns() - start_ns ) / 1e9;
+		std::sort( latencies.begin(), latencies.end() );
+		printf( "%lu readers, %lu taps in %.3f s: %.0f taps/s\n", simulated_readers, taps, seconds, taps / seconds );
+		printf( "tap to event latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			latencies[ latencies.size() / 2 ] / 1e3,
+			latencies[ latencies.size() * 99 / 100 ] / 1e3,
+			latencies.back() / 1e3 );
+	}
+	if( dropped > 0 ) {
+		fprintf( stderr, "%lu taps dropped, queue full\n", dropped );
+	}
+	
+	for( const int client : clients ) {
+		close( client );
+	}
+	if( listen_fd >= 0 ) {
+		close( listen_fd );
+		unlink( socket_path );
+	}
+	tap_ring_close( *ring );
+	munmap( ring, sizeof( tap_ring ) );
+	shm_unlink( ring_name );
+	close( epoll_fd );
+	close( wake_fd );
+	return status;
+}
@@ -0,0 +1,238 @@
+// ==========================================================================
+//
+// File      : tap-ring.hpp
+// Part of   : C++ library for controlling a PN532 chip over I2C or SPI.
+// Copyright : mike.hoogendoorn@student.hu.nl 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at 
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+// ==========================================================================
+
+// Shared memory ring of taps, written by the gateway and read by any
+// number of local processes. Every tap is written once, without system
+// calls. Each consumer keeps its own cursor, the gateway never waits for
+// consumers: a consumer that falls more than TAP_RING_SLOTS taps behind
+// skips to the oldest tap still held and sees an overrun.
+//
+// A gateway that starts replaces the ring by a new shared memory object
+// and closes the old one, so consumers that still map the old ring see it
+// closed and map the new one, instead of waiting on a ring nobody writes.
+
+#ifndef TAP_RING_HPP
+#define TAP_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Taps the ring holds, a power of 2.
+#define TAP_RING_SLOTS 4096
+
+// Shared memory object of the gateway, see shm_open().
+#define TAP_RING_NAME "/pn532-taps"
+
+#define TAP_RING_MAGIC 0x54415031
+
+// The ring is shared between processes, its atomics may not use locks.
+// is_always_lock_free needs C++17, before that the macros tell the same.
+#if __cplusplus >= 201703L
+static_assert( std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "tap ring atomics must be lock free" );
+#else
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "tap ring atomics must be lock free" );
+#endif
+
+struct tap_event {
+	
+	// When the bytes of the record were read, and the reader that sent them.
+	uint64_t read_ns;
+	uint32_t reader;
+	
+	uint16_t sens_res;
+	uint8_t sel_res;
+	uint8_t size_uid;
+	uint8_t uid[10];
+	
+};
+
+struct tap_ring_slot {
+	
+	// Sequence number of the tap held, TAP_RING_WRITING while it changes.
+	std::atomic<uint64_t> sequence;
+	tap_event tap;
+	
+};
+
+#define TAP_RING_WRITING UINT64_MAX
+
+struct tap_ring {
+	
+	uint32_t magic;
+	uint32_t slots;
+	
+	// Sequence number the next tap gets, the amount of taps written so far.
+	std::atomic<uint64_t> head;
+	
+	// Set when the gateway stopped or replaced the ring, no taps follow.
+	std::atomic<uint32_t> closed;
+	
+	tap_ring_slot slot[ TAP_RING_SLOTS ];
+	
+};
+
+// Tells the consumers of a ring that no taps follow.
+inline void tap_ring_close( tap_ring & ring ) {
+	ring.closed.store( 1, std::memory_order_release );
+}
+
+// Whether the object behind fd is large enough to hold a ring. Touching a
+// mapping past the end of the object raises SIGBUS, a new object is empty
+// until its gateway sized it.
+inline bool tap_ring_fits( const int fd ) {
+	struct stat object;
+	return fstat( fd, &object ) == 0 && size_t( object.st_size ) >= sizeof( tap_ring );
+}
+
+// Maps the ring, creates it when create is set. Returns nullptr on failure.
+// Creating closes and unlinks a ring left by a previous gateway first, also
+// one that was not closed because its gateway crashed.
+inline tap_ring * tap_ring_map( const char * name, const bool create ) {
+
+	if( create ) {
+		const int old_fd = shm_open( name, O_RDWR, 0 );
+		if( old_fd >= 0 ) {
+			if( tap_ring_fits( old_fd ) ) {
+				void * old_memory = mmap( nullptr, sizeof( tap_ring ), PROT_READ | PROT_WRITE, MAP_SHARED, old_fd, 0 );
+				if( old_memory != MAP_FAILED ) {
+					tap_ring * old_ring = static_cast<tap_ring *>( old_memory );
+					if( old_ring->magic == TAP_RING_MAGIC && old_ring->slots == TAP_RING_SLOTS ) {
+						tap_ring_close( *old_ring );
+					}
+					munmap( old_memory, sizeof( tap_ring ) );
+				}
+			}
+			close( old_fd );
+		}
+		shm_unlink( name );
+	}
+	
+	const int fd = shm_open( name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDONLY, 0644 );
+	if( fd < 0
+		|| ( create && ftruncate( fd, sizeof( tap_ring ) ) < 0 )
+		|| ( !create && !tap_ring_fits( fd ) )
+	) {
+		if( fd >= 0 ) {
+			close( fd );
+		}
+		return nullptr;
+	}
+	void * memory = mmap( nullptr, sizeof( tap_ring ), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( memory == MAP_FAILED ) {
+		return nullptr;
+	}
+	
+	tap_ring * ring = static_cast<tap_ring *>( memory );
+	if( create ) {
+		ring->slots = TAP_RING_SLOTS;
+		ring->head.store( 0, std::memory_order_relaxed );
+		ring->closed.store( 0, std::memory_order_relaxed );
+		for( size_t i = 0; i < TAP_RING_SLOTS; i++ ) {
+			ring->slot[i].sequence.store( TAP_RING_WRITING, std::memory_order_relaxed );
+		}
+		std::atomic_thread_fence( std::memory_order_release );
+		ring->magic = TAP_RING_MAGIC;
+	}
+	else if( ring->magic != TAP_RING_MAGIC || ring->slots != TAP_RING_SLOTS ) {
+		munmap( memory, sizeof( tap_ring ) );
+		return nullptr;
+	}
+	return ring;
+}
+
+// The only writer of a ring.
+inline void tap_ring_publish( tap_ring & ring, const tap_event & tap ) {
+
+	const uint64_t sequence = ring.head.load( std::memory_order_relaxed );
+	tap_ring_slot & slot = ring.slot[ sequence & ( TAP_RING_SLOTS - 1 ) ];
+	
+	slot.sequence.store( TAP_RING_WRITING, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+	memcpy( &slot.tap, &tap, sizeof( tap ) );
+	slot.sequence.store( sequence, std::memory_order_release );
+	ring.head.store( sequence + 1, std::memory_order_release );
+
+}
+
+// A consumer of a ring with its own cursor, starts at the newest tap or,
+// for a ring mapped again after it was replaced, at the oldest one.
+class tap_ring_reader {
+private:
+
+	const tap_ring & ring;
+	uint64_t cursor;
+	unsigned long skipped;
+
+public:
+
+	tap_ring_reader( const tap_ring & ring, const bool oldest = false ):
+		ring( ring ),
+		cursor( oldest ? 0 : ring.head.load( std::memory_order_acquire ) ),
+		skipped( 0 )
+		{}
+	
+	// Copies the next tap into tap. Returns false when there is none yet.
+	// overrun is set when taps were lost since the previous call.
+	bool next( tap_event & tap, bool & overrun ) {
+		
+		overrun = false;
+		while( true ) {
+			
+			const uint64_t head = ring.head.load( std::memory_order_acquire );
+			if( cursor >= head ) {
+				return false;
+			}
+			if( head - cursor > TAP_RING_SLOTS ) {
+				skipped += head - cursor - TAP_RING_SLOTS;
+				cursor = head - TAP_RING_SLOTS;
+				overrun = true;
+			}
+			
+			// Seqlock: the copy is only valid when the slot held the same
+			// tap before and after copying it.
+			const tap_ring_slot & slot = ring.slot[ cursor & ( TAP_RING_SLOTS - 1 ) ];
+			const uint64_t before = slot.sequence.load( std::memory_order_acquire );
+			memcpy( &tap, &slot.tap, sizeof( tap ) );
+			std::atomic_thread_fence( std::memory_order_acquire );
+			const uint64_t after = slot.sequence.load( std::memory_order_relaxed );
+			if( before == cursor && after == cursor ) {
+				cursor += 1;
+				return true;
+			}
+			
+			// Overwritten while copying, the writer lapped this consumer.
+			overrun = true;
+			
+		}
+	}
+	
+	// Whether the gateway stopped or replaced the ring. Taps published
+	// before that can still be read, after them the consumer should map
+	// the ring again.
+	bool closed() const {
+		return ring.closed.load( std::memory_order_acquire ) != 0;
+	}
+	
+	// Amount of taps lost to overruns.
+	unsigned long skipped_count() const {
+		return skipped;
+	}
+	
+};
+
+#endif // TAP_RING_HPP
@@ -65,19 +65,33 @@ int main() {
 	// This code is only ran when a specific uid is detected.
 	// Potential use for different levels of access.
 	
+	// A little animation over the 4 available gpios on port 3, it plays
+	// while the card gets read instead of making the card wait for it.
+	gpio_sequence animation( object );
+	animation.add( 0x81, 0x00, 200 ); //P30 HIGH
+	animation.add( 0x82, 0x00, 200 ); //P31 HIGH
+	animation.add( 0x88, 0x00, 200 ); //P33 HIGH
+	animation.add( 0xA0, 0x00, 200 ); //P35 HIGH
+	animation.add( 0x80, 0x00, 0 ); // all back to LOW.
+	
 	if( uid == known_uid[1] ) {
 			
 		// We do stuff if we have a known uid.
 		hwlib::cout << "Access level 2 detected!\n";
-		// loop a little animation over the 4 available gpios on port 3.
-		object.write_gpio( 0x81, 0x00 ); hwlib::wait_ms(200); //P30 HIGH
-		object.write_gpio( 0x82, 0x00 ); hwlib::wait_ms(200); //P31 HIGH
-		object.write_gpio( 0x88, 0x00 ); hwlib::wait_ms(200); //P33 HIGH
-		object.write_gpio( 0xA0, 0x00 ); hwlib::wait_ms(200); //P35 HIGH
-		object.write_gpio( 0x80, 0x00 ); // all back to LOW.
+		animation.start();
+	}
+	
+	hwlib::cout << "Do not move the NFC card during this command!\n";
+	for( uint8_t block = 0; block < 64; block++ ) {
+		
+		object.read_eeprom_block( block );
+		animation.update();
+		
 	}
+	hwlib::cout << "\nNFC card can safely be removed.\n\n";
 	
-	object.read_eeprom_all();
+	// Let the animation finish if the card was read before it did.
+	while( animation.update() ) {}
 	
 //	std::array<uint8_t, 16> data = {0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
 //									0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A};
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstring>
+#include "trace-reader.hpp"
+
+// Host tool decoding the binary trace records written by pn532_trace.
+// Usage: main [--json] [file], reads stdin when no file is given.
+// Bytes outside of records (normal console text.) are skipped.
+
+static void print_bytes( const uint8_t data[], const size_t & size_data, const bool json ) {
+
+	for( size_t i = 0; i < size_data; i++ ) {
+		printf( json ? "%s\"%02X\"" : "%s%02X", i == 0 ? "" : json ? "," : " ", data[i] );
+	}
+
+}
+
+// Prints a single record, returns false for unknown types or wrong lengths.
+static bool print_record( const uint8_t type, const uint8_t payload[], const size_t & size_payload, const bool json ) {
+
+	if( type == trace_uid && ( size_payload == 7 || size_payload == 10 || size_payload == 13 ) ) {
+		const unsigned int sens_res = payload[0] | payload[1] << 8;
+		if( json ) {
+			printf( "{\"type\":\"uid\",\"sens_res\":%u,\"sel_res\":%u,\"uid\":[", sens_res, payload[2] );
+			print_bytes( payload + 3, size_payload - 3, json );
+			printf( "]}\n" );
+		}
+		else {
+			printf( "UID (SENS_RES %04X SEL_RES %02X): ", sens_res, payload[2] );
+			print_bytes( payload + 3, size_payload - 3, json );
+			printf( "\n" );
+		}
+		return true;
+	}
+	
+	if( type == trace_block && size_payload == 18 ) {
+		if( json ) {
+			printf( "{\"type\":\"block\",\"block\":%u,\"status\":%u,\"data\":[", payload[0], payload[1] );
+			print_bytes( payload + 2, 16, json );
+			printf( "]}\n" );
+		}
+		else {
+			printf( "block %02X status %02X: ", payload[0], payload[1] );
+			print_bytes( payload + 2, 16, json );
+			printf( "\n" );
+		}
+		return true;
+	}
+	
+	if( type == trace_stats && size_payload == 8 ) {
+		const unsigned long time_ms = trace_u32( payload );
+		const unsigned long frames = trace_u32( payload + 4 );
+		if( json ) {
+			printf( "{\"type\":\"stats\",\"time_ms\":%lu,\"frames\":%lu}\n", time_ms, frames );
+		}
+		else {
+			printf( "stats at %lu ms: %lu frames\n", time_ms, frames );
+		}
+		return true;
+	}
+	
+	return false;
+}
+
+// Prints every record it finds.
+class decoder : public trace_reader {
+protected:
+
+	bool record( const uint8_t type, const uint8_t payload[], const size_t & size_payload ) override {
+		return print_record( type, payload, size_payload, json );
+	}
+
+public:
+
+	bool json = false;
+	
+};
+
+int main( int argc, char * argv[] ) {
+
+	decoder trace;
+	FILE * in = stdin;
+	for( int i = 1; i < argc; i++ ) {
+		if( strcmp( argv[i], "--json" ) == 0 ) {
+			trace.json = true;
+		}
+		else {
+			in = fopen( argv[i], "rb" );
+			if( in == nullptr ) {
+				fprintf( stderr, "cannot open %s\n", argv[i] );
+				return 1;
+			}
+		}
+	}
+	
+	int c;
+	while( ( c = fgetc( in ) ) != EOF ) {
+		trace.feed( uint8_t( c ) );
+	}
+	
+	if( trace.error_count() > 0 ) {
+		fprintf( stderr, "%lu damaged or unknown records skipped\n", trace.error_count() );
+	}
+	if( in != stdin ) {
+		fclose( in );
+	}
+	return 0;
+}
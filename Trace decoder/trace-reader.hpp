@@ -0,0 +1,129 @@
+// ==========================================================================
+//
+// File      : trace-reader.hpp
+// Part of   : C++ library for controlling a PN532 chip over I2C or SPI.
+// Copyright : mike.hoogendoorn@student.hu.nl 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at 
+// http://www.boost.org/LICENSE_1_0.txt)
+//
+// ==========================================================================
+
+// Host side reader of the binary trace records written by pn532_trace.
+// Used by the trace decoder and the gateway, both hold the same copy.
+
+#ifndef TRACE_READER_HPP
+#define TRACE_READER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Record format, must match the trace defines in pn532.hpp.
+#define TRACE_SYNC 0xA5
+#define TRACE_PAYLOAD_MAX 32
+#define trace_uid 0x01
+#define trace_block 0x02
+#define trace_stats 0x03
+
+// Same CRC-8 as pn532_trace::crc8().
+inline uint8_t trace_crc8( const uint8_t data[], const size_t & size_data, uint8_t crc = 0 ) {
+
+	for( size_t i = 0; i < size_data; i++ ) {
+		crc ^= data[i];
+		for( size_t bit = 0; bit < 8; bit++ ) {
+			crc = ( crc & 0x80 ) ? uint8_t( ( crc << 1 ) ^ 0x07 ) : uint8_t( crc << 1 );
+		}
+	}
+	return crc;
+}
+
+// Builds a record like pn532_trace does, out must hold size_payload + 4 bytes.
+inline size_t trace_encode( const uint8_t type, const uint8_t payload[], const size_t & size_payload, uint8_t out[] ) {
+
+	out[0] = TRACE_SYNC;
+	out[1] = type;
+	out[2] = uint8_t( size_payload );
+	memcpy( out + 3, payload, size_payload );
+	out[ size_payload + 3 ] = trace_crc8( out + 1, size_payload + 2 );
+	return size_payload + 4;
+}
+
+inline uint32_t trace_u32( const uint8_t data[] ) {
+
+	return uint32_t( data[0] ) | uint32_t( data[1] ) << 8 | uint32_t( data[2] ) << 16 | uint32_t( data[3] ) << 24;
+}
+
+// Collects bytes into records, starting at TRACE_SYNC. Every record with a
+// correct CRC is passed to record(), which returns false for unknown types
+// or wrong lengths. Bytes outside of records (normal console text.) are skipped.
+class trace_reader {
+private:
+
+	uint8_t buffer[ TRACE_PAYLOAD_MAX + 4 ];
+	size_t size_buffer = 0;
+	unsigned long errors = 0;
+	
+	// Not a record after all, the sync byte was part of text or a damaged
+	// record: look for the next record inside the bytes after it.
+	void resync() {
+		
+		uint8_t skipped[ TRACE_PAYLOAD_MAX + 4 ];
+		const size_t size_skipped = size_buffer - 1;
+		memcpy( skipped, buffer + 1, size_skipped );
+		size_buffer = 0;
+		for( size_t i = 0; i < size_skipped; i++ ) {
+			feed( skipped[i] );
+		}
+		
+	}
+
+protected:
+
+	virtual bool record( const uint8_t type, const uint8_t payload[], const size_t & size_payload ) = 0;
+
+public:
+
+	virtual ~trace_reader() {}
+	
+	void feed( const uint8_t byte ) {
+		
+		if( size_buffer == 0 && byte != TRACE_SYNC ) {
+			return;
+		}
+		buffer[ size_buffer++ ] = byte;
+		
+		if( size_buffer == 3 && buffer[2] > TRACE_PAYLOAD_MAX ) {
+			resync();
+		}
+		else if( size_buffer >= 3 && size_buffer == size_t( buffer[2] ) + 4 ) {
+			if( trace_crc8( buffer + 1, size_buffer - 2 ) == buffer[ size_buffer - 1 ]
+				&& record( buffer[1], buffer + 3, buffer[2] )
+			) {
+				size_buffer = 0;
+			}
+			else {
+				errors += 1;
+				resync();
+			}
+		}
+		
+	}
+	
+	void feed( const uint8_t data[], const size_t & size_data ) {
+		
+		for( size_t i = 0; i < size_data; i++ ) {
+			feed( data[i] );
+		}
+		
+	}
+	
+	// Amount of damaged or unknown records skipped.
+	unsigned long error_count() const {
+		return errors;
+	}
+	
+};
+
+#endif // TRACE_READER_HPP